@@ -0,0 +1,70 @@
+#include <time.h>
+
+#include "bench.h"
+
+uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t bench_rand(uint32_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+void samples_init(samples_t *samples, int capacity)
+{
+	samples->values = malloc(capacity * sizeof(double));
+	DIE(!samples->values, "samples malloc failed!");
+	samples->count = 0;
+	samples->capacity = capacity;
+}
+
+/* Values past the capacity are dropped */
+void samples_add(samples_t *samples, double value)
+{
+	if (samples->count != samples->capacity)
+		samples->values[samples->count++] = value;
+}
+
+void samples_free(samples_t *samples)
+{
+	free(samples->values);
+	samples->values = NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+void bench_header(void)
+{
+	printf("bench,param,unit,samples,min,median,p99\n");
+	fflush(stdout);
+}
+
+/* Nearest rank percentiles, the samples are sorted in place */
+void bench_report(const char *bench, unsigned long param, const char *unit,
+		  samples_t *samples)
+{
+	double *v = samples->values;
+	int n = samples->count;
+
+	if (!n)
+		return;
+
+	qsort(v, n, sizeof(double), cmp_double);
+	printf("%s,%lu,%s,%d,%.1f,%.1f,%.1f\n", bench, param, unit, n, v[0],
+	       v[(n - 1) / 2], v[(n * 99 + 99) / 100 - 1]);
+	fflush(stdout);
+	samples->count = 0;
+}
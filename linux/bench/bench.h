@@ -0,0 +1,42 @@
+/**
+ * Helpers shared by the benchmarks: a monotonic clock, a sample set and
+ * its report. Every measurement is one CSV line
+ * bench,param,unit,samples,min,median,p99
+ * over the samples of repeated runs, so two builds can be compared line
+ * by line.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+#include "../utils.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct samples_t samples_t;
+struct samples_t {
+	double *values;
+	int count;
+	int capacity;
+};
+
+/* CLOCK_MONOTONIC time in ns */
+uint64_t bench_ns(void);
+
+/* xorshift32, cheap enough to call in a timed loop, seed must not be 0 */
+uint32_t bench_rand(uint32_t *seed);
+
+void samples_init(samples_t *samples, int capacity);
+
+void samples_add(samples_t *samples, double value);
+
+void samples_free(samples_t *samples);
+
+void bench_header(void);
+
+void bench_report(const char *bench, unsigned long param, const char *unit,
+		  samples_t *samples);
+
+#endif /* BENCH_H_ */
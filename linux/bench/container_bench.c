@@ -0,0 +1,365 @@
+/**
+ * Container microbenchmarks: queue_push/queue_pop/queue_top of prio_queue
+ * under three priority distributions (uniform, skewed to the max
+ * priority, all equal) and add_node/remove_node/get_node of linkedlist at
+ * random positions, at sizes from 10 to 1M. Reports ns/op and allocs/op
+ * as CSV, see bench.h. The allocations are counted by wrapping malloc and
+ * calloc at link time.
+ *
+ * A size is skipped, with the larger ones, once an op would take longer
+ * than MAX_OP_NS going by the previous size and a quadratic growth.
+ *
+ * Usage: container_bench [runs]
+ */
+
+#include "bench.h"
+#include "../prio_queue.h"
+#include "../so_scheduler.h"
+
+/* Default number of repeated runs of every benchmark */
+#define RUNS 10
+
+/* Target duration of a run, the op count of a run follows from it */
+#define RUN_NS 2000000.0
+
+/* Bounds of the op count of a run */
+#define MAX_OPS 10000
+
+/* Longest op worth measuring */
+#define MAX_OP_NS 100000000.0
+
+#define LEVELS (SO_MAX_PRIO + 1)
+
+/* Priority distributions */
+enum {
+	DIST_UNIFORM,
+	DIST_SKEWED,
+	DIST_EQUAL,
+	DISTS
+};
+
+static const char * const dist_names[DISTS] = { "uniform", "skewed", "equal" };
+
+static const int sizes[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+
+typedef struct elem_t elem_t;
+struct elem_t {
+	int prio;
+};
+
+static int runs = RUNS;
+static int dist;
+static uint32_t seed = 1;
+
+/* Elements of the container, then the ones pushed by a run */
+static elem_t *elems;
+/* Elements or nodes taken out by a run */
+static void **saved;
+static prio_queue_t *queue;
+static LinkedList list;
+
+/* Allocations since the start and during the last run */
+static unsigned long allocs;
+static unsigned long run_allocs;
+
+static volatile void *sink;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	++allocs;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	++allocs;
+	return __real_calloc(nmemb, size);
+}
+
+/* Skewed: half of the elements at the max priority, a quarter under it... */
+static int random_prio(void)
+{
+	uint32_t r = bench_rand(&seed);
+
+	switch (dist) {
+	case DIST_UNIFORM:
+		return r % LEVELS;
+	case DIST_SKEWED:
+		r = __builtin_ctz(r | 1U << SO_MAX_PRIO);
+		return SO_MAX_PRIO - r;
+	default:
+		return SO_MAX_PRIO;
+	}
+}
+
+static int cmp_elem(const void *a, const void *b)
+{
+	return ((const elem_t *)a)->prio - ((const elem_t *)b)->prio;
+}
+
+static void free_elem(void *a)
+{
+	(void)a;
+}
+
+static void elems_init(int n)
+{
+	elems = calloc(n + MAX_OPS, sizeof(elem_t));
+	saved = calloc(MAX_OPS, sizeof(void *));
+	DIE(!elems || !saved, "calloc failed!");
+
+	for (int i = 0; i != n + MAX_OPS; ++i)
+		elems[i].prio = random_prio();
+}
+
+static void elems_free(void)
+{
+	free(elems);
+	free(saved);
+}
+
+/*
+ * Builds the list queue_push would: by decreasing priority, FIFO among
+ * equals. Appending keeps it linear, queue_push is quadratic.
+ */
+static void queue_fill(int n)
+{
+	queue = queue_init(cmp_elem, free_elem);
+	for (int prio = SO_MAX_PRIO; prio >= 0; --prio)
+		for (int i = 0; i != n; ++i)
+			if (elems[i].prio == prio)
+				add_node(queue->list, queue->size++, &elems[i]);
+}
+
+static void queue_setup(int n)
+{
+	elems_init(n);
+	queue_fill(n);
+}
+
+static void queue_teardown(void)
+{
+	queue_free(queue);
+	elems_free();
+}
+
+/* The queue is rebuilt for every run, so it does not drift */
+static double queue_push_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	queue_fill(n);
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		queue_push(queue, &elems[n + i]);
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+	queue_free(queue);
+
+	return start;
+}
+
+/* The popped elements go back at the head, in order */
+static double queue_pop_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	(void)n;
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		saved[i] = queue_pop(queue);
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+
+	while (k--) {
+		add_node(queue->list, 0, saved[k]);
+		++queue->size;
+	}
+
+	return start;
+}
+
+static double queue_top_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	(void)n;
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		sink = queue_top(queue);
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+
+	return start;
+}
+
+static void list_setup(int n)
+{
+	elems_init(n);
+	list_init(&list, free_elem);
+	for (int i = 0; i != n; ++i)
+		add_node(&list, i, &elems[i]);
+}
+
+static void list_teardown(void)
+{
+	Node *node;
+
+	while ((node = remove_node(&list, 0)))
+		free(node);
+	elems_free();
+}
+
+/* The added nodes are removed from the head afterwards */
+static double list_add_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		add_node(&list, bench_rand(&seed) % (n + i + 1), &elems[n + i]);
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+
+	while (k--)
+		free(remove_node(&list, 0));
+
+	return start;
+}
+
+/* The removed nodes are free'd and replaced at the back afterwards */
+static double list_remove_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		saved[i] = remove_node(&list, bench_rand(&seed) % (n - i));
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+
+	for (int i = 0; i != k; ++i) {
+		add_node(&list, list.size, ((Node *)saved[i])->data);
+		free(saved[i]);
+	}
+
+	return start;
+}
+
+static double list_get_run(int n, int k)
+{
+	uint64_t start;
+	unsigned long base;
+
+	base = allocs;
+	start = bench_ns();
+	for (int i = 0; i != k; ++i)
+		sink = get_node(&list, bench_rand(&seed) % n);
+	start = bench_ns() - start;
+	run_allocs = allocs - base;
+
+	return start;
+}
+
+typedef struct bench_op_t bench_op_t;
+struct bench_op_t {
+	const char *name;
+	/* Ops depending on the priority distribution */
+	int by_dist;
+	void (*setup)(int n);
+	/* Time of k ops on a container of size n, in ns */
+	double (*run)(int n, int k);
+	void (*teardown)(void);
+};
+
+static const bench_op_t ops[] = {
+	{ "queue_push", 1, elems_init, queue_push_run, elems_free },
+	{ "queue_pop", 1, queue_setup, queue_pop_run, queue_teardown },
+	{ "queue_top", 1, queue_setup, queue_top_run, queue_teardown },
+	{ "list_add_node", 0, list_setup, list_add_run, list_teardown },
+	{ "list_remove_node", 0, list_setup, list_remove_run, list_teardown },
+	{ "list_get_node", 0, list_setup, list_get_run, list_teardown },
+};
+
+static void bench_op(const bench_op_t *op, const char *name)
+{
+	samples_t ns, alloc;
+	double est = 0, ratio;
+	int prev = 0, n, k;
+
+	samples_init(&ns, runs);
+	samples_init(&alloc, runs);
+
+	for (unsigned int s = 0; s != ARRAY_SIZE(sizes); ++s) {
+		n = sizes[s];
+		ratio = prev ? (double)n / prev : 1;
+		if (est * ratio * ratio > MAX_OP_NS) {
+			fprintf(stderr, "%s: sizes from %d skipped, %.0f ns/op at %d\n",
+				name, n, est, prev);
+			break;
+		}
+
+		op->setup(n);
+
+		/* A single op, as a warm up and to size the runs */
+		est = op->run(n, 1);
+		k = RUN_NS / (est > 1 ? est : 1);
+		k = k > MAX_OPS ? MAX_OPS : k;
+		k = k > n ? n : k < 1 ? 1 : k;
+
+		for (int r = 0; r != runs; ++r) {
+			samples_add(&ns, op->run(n, k) / k);
+			samples_add(&alloc, (double)run_allocs / k);
+		}
+		est = ns.values[ns.count - 1];
+
+		bench_report(name, n, "ns/op", &ns);
+		bench_report(name, n, "allocs/op", &alloc);
+		op->teardown();
+		prev = n;
+	}
+
+	samples_free(&ns);
+	samples_free(&alloc);
+}
+
+int main(int argc, char **argv)
+{
+	char name[64];
+
+	if (argc == 2)
+		runs = atoi(argv[1]);
+
+	if (argc > 2 || runs <= 0) {
+		fprintf(stderr, "usage: %s [runs]\n", argv[0]);
+		return 1;
+	}
+
+	bench_header();
+	for (unsigned int i = 0; i != ARRAY_SIZE(ops); ++i) {
+		if (!ops[i].by_dist) {
+			bench_op(&ops[i], ops[i].name);
+			continue;
+		}
+
+		for (dist = 0; dist != DISTS; ++dist) {
+			snprintf(name, sizeof(name), "%s_%s", ops[i].name, dist_names[dist]);
+			bench_op(&ops[i], name);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * Scheduler microbenchmarks: task switch, preemption, fork and broadcast
+ * latencies through the public API, the task switch again with tracing
+ * on, the cost of a trace record, and the ready queue operations at
+ * several queue sizes. Prints CSV, see bench.h.
+ *
+ * Usage: sched_bench [runs]
+ */
+
+#include "bench.h"
+#include "../so_scheduler.h"
+#include "../bucket_queue.h"
+#include "../trace.h"
+
+/* Default number of repeated runs of every benchmark */
+#define RUNS 20
+
+/* Switches per task and per run in the ping-pong */
+#define PINGPONG_ROUNDS 1000
+
+/* Higher priority forks per run */
+#define PREEMPT_FORKS 200
+
+/* Forks per run, timed as a batch */
+#define FORK_BATCH 200
+
+/* Push/pop pairs per run on the ready queue */
+#define QUEUE_OPS 100000
+
+/* Capacity of the trace ring in the traced runs */
+#define TRACE_RECORDS 65536
+
+/* Records added per run of trace_event */
+#define TRACE_OPS 1000000
+
+static int runs = RUNS;
+static samples_t samples;
+
+/* Start of the measured interval and the task which set it */
+static uint64_t mark;
+static pthread_t marker;
+
+/* Time the last woken waiter ran */
+static uint64_t last_wake;
+
+/* Parameter of the running benchmark */
+static unsigned int param;
+
+/* Runs record a trace */
+static int traced;
+
+/*
+ * Two tasks of the same priority with a quantum of one so_exec: every
+ * so_exec hands the processor to the other task. The time from the
+ * so_exec of one task to the return of the other one is a switch.
+ */
+static void pingpong_task(unsigned int prio)
+{
+	(void)prio;
+
+	for (int i = 0; i != PINGPONG_ROUNDS; ++i) {
+		marker = pthread_self();
+		mark = bench_ns();
+		so_exec();
+		if (!pthread_equal(marker, pthread_self()))
+			samples_add(&samples, bench_ns() - mark);
+	}
+}
+
+static void pingpong_start(unsigned int prio)
+{
+	so_fork(pingpong_task, prio);
+	pingpong_task(prio);
+}
+
+/* From the so_fork of the parent to the first instruction of the child */
+static void preempt_child(unsigned int prio)
+{
+	(void)prio;
+	samples_add(&samples, bench_ns() - mark);
+}
+
+static void preempt_parent(unsigned int prio)
+{
+	for (int i = 0; i != PREEMPT_FORKS; ++i) {
+		mark = bench_ns();
+		so_fork(preempt_child, prio + 1);
+	}
+}
+
+static void fork_child(unsigned int prio)
+{
+	(void)prio;
+}
+
+/* The children have a lower priority, so so_fork returns without a switch */
+static void fork_parent(unsigned int prio)
+{
+	uint64_t start = bench_ns();
+
+	for (int i = 0; i != FORK_BATCH; ++i)
+		so_fork(fork_child, prio - 1);
+
+	samples_add(&samples, (double)(bench_ns() - start) / FORK_BATCH);
+}
+
+static void broadcast_waiter(unsigned int prio)
+{
+	(void)prio;
+	so_wait(0);
+	last_wake = bench_ns();
+}
+
+/*
+ * The waiters preempt the parent and park on io 0 one by one, then a
+ * single so_signal wakes them all. Measured up to the last waiter running.
+ */
+static void broadcast_parent(unsigned int prio)
+{
+	for (unsigned int i = 0; i != param; ++i)
+		so_fork(broadcast_waiter, prio + 1);
+
+	mark = bench_ns();
+	so_signal(0);
+	samples_add(&samples, last_wake - mark);
+}
+
+static void run(so_handler *func, unsigned int time_quantum, unsigned int prio)
+{
+	DIE(so_init(time_quantum, 1), "so_init failed!");
+	if (traced)
+		DIE(so_trace_start(NULL, TRACE_RECORDS), "so_trace_start failed!");
+	DIE(so_fork(func, prio) == INVALID_TID, "so_fork failed!");
+	so_end();
+}
+
+static void bench_sched(void)
+{
+	static const unsigned int waiters[] = { 10, 100, 1000 };
+
+	samples_init(&samples, runs * PINGPONG_ROUNDS * 2);
+
+	for (int i = 0; i != runs; ++i)
+		run(pingpong_start, 1, 1);
+	bench_report("pingpong_switch", 2, "ns", &samples);
+
+	/* A switch records a preemption and a dispatch */
+	traced = 1;
+	for (int i = 0; i != runs; ++i)
+		run(pingpong_start, 1, 1);
+	traced = 0;
+	bench_report("pingpong_switch_traced", 2, "ns", &samples);
+
+	for (int i = 0; i != runs; ++i)
+		run(preempt_parent, 1000, 0);
+	bench_report("fork_preempt", 1, "ns", &samples);
+
+	for (int i = 0; i != runs; ++i)
+		run(fork_parent, 1000, SO_MAX_PRIO);
+	bench_report("fork_throughput", FORK_BATCH, "ns/fork", &samples);
+
+	for (unsigned int w = 0; w != ARRAY_SIZE(waiters); ++w) {
+		param = waiters[w];
+		for (int i = 0; i != runs; ++i)
+			run(broadcast_parent, 1000, 0);
+		bench_report("signal_broadcast", param, "ns", &samples);
+	}
+
+	samples_free(&samples);
+}
+
+typedef struct elem_t elem_t;
+struct elem_t {
+	struct Node node;
+	int prio;
+};
+
+/*
+ * The ready queue at a steady size: pop the top task and push it back
+ * with a random priority, as a preempted or woken task would be.
+ */
+static void bench_ready_queue(void)
+{
+	static const int sizes[] = { 10, 1000, 100000 };
+	bucket_queue_t *queue;
+	elem_t *elems, *elem;
+	uint32_t seed = 1;
+	uint64_t start;
+
+	samples_init(&samples, runs);
+
+	for (unsigned int s = 0; s != ARRAY_SIZE(sizes); ++s) {
+		elems = calloc(sizes[s], sizeof(elem_t));
+		DIE(!elems, "calloc failed!");
+
+		queue = bqueue_init(SO_MAX_PRIO + 1);
+		for (int i = 0; i != sizes[s]; ++i) {
+			elems[i].node.data = &elems[i];
+			elems[i].prio = bench_rand(&seed) % (SO_MAX_PRIO + 1);
+			bqueue_push(queue, &elems[i].node, elems[i].prio);
+		}
+
+		for (int r = 0; r != runs; ++r) {
+			start = bench_ns();
+			for (int i = 0; i != QUEUE_OPS; ++i) {
+				elem = bqueue_pop(queue);
+				elem->prio = bench_rand(&seed) % (SO_MAX_PRIO + 1);
+				bqueue_push(queue, &elem->node, elem->prio);
+			}
+			samples_add(&samples, (double)(bench_ns() - start) / QUEUE_OPS);
+		}
+		bench_report("ready_queue_pop_push", sizes[s], "ns/op", &samples);
+
+		bqueue_free(queue);
+		free(elems);
+	}
+
+	samples_free(&samples);
+}
+
+/* trace_add alone, as called by the scheduler for every event */
+static void bench_trace(void)
+{
+	trace_ring_t *ring = trace_init(TRACE_RECORDS);
+	uint64_t start;
+
+	samples_init(&samples, runs);
+
+	for (int r = 0; r != runs; ++r) {
+		start = bench_ns();
+		for (int i = 0; i != TRACE_OPS; ++i)
+			trace_add(ring, TRACE_DISPATCH, i, 1, i);
+		samples_add(&samples, (double)(bench_ns() - start) / TRACE_OPS);
+	}
+	bench_report("trace_event", TRACE_RECORDS, "ns/event", &samples);
+
+	trace_free(ring);
+	samples_free(&samples);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2)
+		runs = atoi(argv[1]);
+
+	if (argc > 2 || runs <= 0) {
+		fprintf(stderr, "usage: %s [runs]\n", argv[0]);
+		return 1;
+	}
+
+	bench_header();
+	bench_sched();
+	bench_trace();
+	bench_ready_queue();
+
+	return 0;
+}
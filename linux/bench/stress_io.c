@@ -0,0 +1,192 @@
+/**
+ * Scalability stress run of the test_sched_22 choreography with the load
+ * set on the command line. A master at SO_MAX_PRIO forks the high and
+ * the medium workers, then waits on device 0 once per high worker. The
+ * high workers park on the first half of the devices, the medium ones
+ * wake them, each high worker wakes the master, and the medium workers
+ * park on the second half. The master then forks the low workers, which
+ * wake the medium ones. Workers share the devices round robin when they
+ * outnumber them. Prints one CSV line with the wall time, the peak RSS
+ * and the switches per second, and fails if a worker did not complete.
+ *
+ * Usage: stress_io [-t tasks] [-d devices] [-m high:med:low] [-q quantum]
+ *                  [-s stack_kb]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "../so_scheduler.h"
+
+static unsigned int high_prio = SO_MAX_PRIO - 1;
+static unsigned int med_prio = SO_MAX_PRIO - 2;
+static unsigned int low_prio = SO_MAX_PRIO - 3;
+
+/* Workers per class and devices per half */
+static unsigned int highs, meds, lows;
+static unsigned int high_devs, med_devs;
+
+/* Workers of each class which reached their device or completed */
+static unsigned int high_seq, med_seq, med_wait_seq, low_seq;
+static unsigned int high_done, med_done, low_done;
+
+static so_stats_t stats;
+
+static void fail(const char *msg)
+{
+	fprintf(stderr, "stress_io: %s\n", msg);
+	exit(1);
+}
+
+static void high_worker(unsigned int priority)
+{
+	(void)priority;
+	so_exec();
+
+	if (so_wait(1 + high_seq++ % high_devs))
+		fail("high worker cannot wait on its device");
+
+	so_exec();
+
+	/* Only the master waits on device 0 */
+	if (so_signal(0) != 1)
+		fail("high worker should wake the master");
+
+	so_exec();
+	++high_done;
+}
+
+static void med_worker(unsigned int priority)
+{
+	(void)priority;
+	so_exec();
+
+	if (so_signal(1 + med_seq++ % high_devs) < 0)
+		fail("med worker cannot signal its device");
+
+	so_exec();
+
+	if (so_wait(1 + high_devs + med_wait_seq++ % med_devs))
+		fail("med worker cannot wait on its device");
+
+	so_exec();
+	++med_done;
+}
+
+static void low_worker(unsigned int priority)
+{
+	(void)priority;
+	so_exec();
+
+	if (so_signal(1 + high_devs + low_seq++ % med_devs) < 0)
+		fail("low worker cannot signal its device");
+
+	so_exec();
+
+	/* The last low worker takes the counters before the reaping */
+	if (++low_done == lows)
+		so_get_stats(NULL, &stats, NULL, 0);
+}
+
+static void master_task(unsigned int priority)
+{
+	(void)priority;
+
+	for (unsigned int i = 0; i != highs; ++i)
+		if (so_fork(high_worker, high_prio) == INVALID_TID)
+			fail("cannot create a high worker");
+
+	for (unsigned int i = 0; i != meds; ++i)
+		if (so_fork(med_worker, med_prio) == INVALID_TID)
+			fail("cannot create a med worker");
+
+	for (unsigned int i = 0; i != highs; ++i)
+		if (so_wait(0))
+			fail("master cannot wait on device 0");
+
+	for (unsigned int i = 0; i != lows; ++i)
+		if (so_fork(low_worker, low_prio) == INVALID_TID)
+			fail("cannot create a low worker");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t tasks] [-d devices] [-m high:med:low] [-q quantum]"
+		" [-s stack_kb]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int tasks = 3 * SO_MAX_NUM_EVENTS / 2, devices = SO_MAX_NUM_EVENTS;
+	unsigned int mix[3] = { 1, 1, 1 }, quantum = 1, stack_kb = 64, sum;
+	pthread_attr_t attr;
+	struct rusage usage_self;
+	uint64_t start;
+	double wall;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:m:q:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			tasks = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			devices = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%u:%u:%u", &mix[0], &mix[1], &mix[2]) != 3)
+				print_usage(argv[0]);
+			break;
+		case 'q':
+			quantum = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			stack_kb = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	sum = mix[0] + mix[1] + mix[2];
+	if (optind != argc || !sum || !quantum || devices < 3 || devices > SO_MAX_NUM_EVENTS)
+		print_usage(argv[0]);
+
+	highs = (unsigned long long)tasks * mix[0] / sum;
+	meds = (unsigned long long)tasks * mix[1] / sum;
+	lows = tasks - highs - meds;
+	high_devs = (devices - 1) / 2;
+	med_devs = devices - 1 - high_devs;
+
+	/* Every device a worker parks on has to be signaled */
+	if (meds < (highs < high_devs ? highs : high_devs) ||
+	    lows < (meds < med_devs ? meds : med_devs))
+		fail("the mix leaves workers parked forever, "
+		     "it needs med >= min(high, devices / 2) and low >= min(med, devices / 2)");
+
+	/* The scheduler creates its threads with the default attributes */
+	DIE(pthread_attr_init(&attr), "pthread_attr_init failed!");
+	if (stack_kb)
+		DIE(pthread_attr_setstacksize(&attr, stack_kb * 1024), "invalid stack size");
+	DIE(pthread_setattr_default_np(&attr), "pthread_setattr_default_np failed!");
+	pthread_attr_destroy(&attr);
+
+	start = bench_ns();
+	DIE(so_init(quantum, devices), "so_init failed!");
+	DIE(so_fork(master_task, SO_MAX_PRIO) == INVALID_TID, "so_fork failed!");
+	so_end();
+	wall = (bench_ns() - start) / 1e9;
+
+	if (high_done != highs || med_done != meds || low_done != lows)
+		fail("some workers did not complete");
+
+	DIE(getrusage(RUSAGE_SELF, &usage_self), "getrusage failed!");
+	printf("tasks,devices,mix,quantum,wall_s,peak_rss_kb,switches,switches_per_s\n");
+	printf("%u,%u,%u:%u:%u,%u,%.3f,%ld,%llu,%.0f\n", tasks, devices, mix[0], mix[1], mix[2],
+	       quantum, wall, usage_self.ru_maxrss, stats.switches, stats.switches / wall);
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "bucket_queue.h"
+
+bucket_queue_t *bqueue_init(int levels)
+{
+	bucket_queue_t *queue = calloc(1, sizeof(bucket_queue_t));
+
+	DIE(!queue, "bqueue calloc failed!");
+
+	DIE(levels <= 0 || levels > BQUEUE_MAX_LEVELS, "Invalid number of levels!");
+	queue->levels     = levels;
+
+	queue->buckets = calloc(levels, sizeof(LinkedList));
+	DIE(!queue->buckets, "queue->buckets calloc failed!");
+
+	for (int i = 0; i != levels; ++i)
+		list_init(&queue->buckets[i], NULL);
+
+	return queue;
+}
+
+/* Insert at the back of its priority bucket (round robin between peers) */
+void bqueue_push(bucket_queue_t *queue, Node *node, int prio)
+{
+	if (!queue || !node || prio < 0 || prio >= queue->levels)
+		return;
+
+	link_node(&queue->buckets[prio], node);
+	queue->mask |= 1ULL << prio;
+	++queue->size;
+}
+
+void *bqueue_pop(bucket_queue_t *queue)
+{
+	Node *node;
+	int prio = bqueue_top_prio(queue);
+
+	if (prio < 0)
+		return NULL;
+
+	node = queue->buckets[prio].head;
+	bqueue_remove(queue, node, prio);
+
+	return node->data;
+}
+
+/* Highest non-empty priority level or -1 if the queue is empty */
+int bqueue_top_prio(bucket_queue_t *queue)
+{
+	if (!queue || !queue->mask)
+		return -1;
+
+	return 63 - __builtin_clzll(queue->mask);
+}
+
+void bqueue_remove(bucket_queue_t *queue, Node *node, int prio)
+{
+	if (!queue || !node || prio < 0 || prio >= queue->levels)
+		return;
+
+	unlink_node(&queue->buckets[prio], node);
+	if (!queue->buckets[prio].size)
+		queue->mask &= ~(1ULL << prio);
+	--queue->size;
+}
+
+/* Elements and their nodes belong to the caller, only the buckets are free'd */
+void bqueue_free(bucket_queue_t *queue)
+{
+	if (!queue)
+		return;
+
+	free(queue->buckets);
+	free(queue);
+}
+
+int bqueue_size(bucket_queue_t *queue)
+{
+	return queue ? queue->size : -1;
+}
@@ -0,0 +1,42 @@
+/**
+ * Priority queue with one FIFO bucket per priority level.
+ * Elements are linked through caller-owned nodes, so push/pop/remove
+ * never allocate and all of them run in constant time. The queue does
+ * not own its elements.
+ */
+
+#ifndef BUCKET_QUEUE_H_
+#define BUCKET_QUEUE_H_
+
+#include "linkedlist.h"
+
+/* Max number of priority levels a bucket queue can hold */
+#define BQUEUE_MAX_LEVELS 64
+
+typedef struct bucket_queue_t bucket_queue_t;
+struct bucket_queue_t {
+	/* One list per priority level */
+	LinkedList *buckets;
+	/* Number of priority levels */
+	int levels;
+	/* Queue size */
+	int size;
+	/* Bit i is set when buckets[i] is not empty */
+	unsigned long long mask;
+};
+
+bucket_queue_t *bqueue_init(int levels);
+
+void bqueue_push(bucket_queue_t *queue, Node *node, int prio);
+
+void *bqueue_pop(bucket_queue_t *queue);
+
+int bqueue_top_prio(bucket_queue_t *queue);
+
+void bqueue_remove(bucket_queue_t *queue, Node *node, int prio);
+
+void bqueue_free(bucket_queue_t *queue);
+
+int bqueue_size(bucket_queue_t *queue);
+
+#endif /* BUCKET_QUEUE_H_ */
@@ -0,0 +1,79 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "flight.h"
+
+static uint64_t round_pow2(unsigned int n)
+{
+	uint64_t size = 1;
+
+	while (size < n)
+		size <<= 1;
+
+	return size;
+}
+
+/* Creates or truncates the file at path and maps it, NULL on error */
+flight_t *flight_open(const char *path, unsigned int records, unsigned int slots)
+{
+	flight_t *flight;
+	void *mem;
+	int fd;
+	uint64_t nrecs = round_pow2(records), nslots = round_pow2(slots);
+	size_t size = sizeof(flight_hdr_t) + nrecs * sizeof(trace_rec_t) +
+		      nslots * sizeof(task_slot_t);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, size)) {
+		close(fd);
+		return NULL;
+	}
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	DIE(!(flight = calloc(1, sizeof(flight_t))), "flight calloc failed!");
+	flight->hdr = mem;
+	flight->size = size;
+
+	flight->hdr->rec_size = sizeof(trace_rec_t);
+	flight->hdr->slot_size = sizeof(task_slot_t);
+	flight->hdr->records = nrecs;
+	flight->hdr->slots = nslots;
+	/* Last, a reader seeing the magic sees a complete header */
+	memcpy(flight->hdr->magic, FLIGHT_MAGIC, sizeof(flight->hdr->magic));
+
+	flight->ring = trace_map((trace_rec_t *)(flight->hdr + 1), nrecs, &flight->hdr->head);
+	flight->slots = (task_slot_t *)(flight->ring->recs + nrecs);
+
+	/* A crash leaves no later reading, measure the counter rate right away */
+	flight->hdr->clock[0] = flight->ring->start;
+	do
+		trace_clock(&flight->hdr->clock[1]);
+	while (flight->hdr->clock[1].ns - flight->hdr->clock[0].ns < FLIGHT_CALIBRATE_NS);
+
+	return flight;
+}
+
+task_slot_t *flight_slot(flight_t *flight, unsigned int seq)
+{
+	return &flight->slots[seq & (flight->hdr->slots - 1)];
+}
+
+/* Unmaps the file, the ring is released by trace_free */
+void flight_close(flight_t *flight)
+{
+	if (!flight)
+		return;
+
+	/* A longer interval, a more precise rate */
+	trace_clock(&flight->hdr->clock[1]);
+	DIE(munmap(flight->hdr, flight->size), "munmap failed!");
+	free(flight);
+}
@@ -0,0 +1,82 @@
+/**
+ * Flight recorder: a shared file mapping holding the trace ring and one
+ * state slot per task. The kernel keeps the pages of a shared mapping in
+ * the file, so the content survives exit(), DIE and fatal signals and can
+ * be read post-mortem with tools/flightdump. The layout below is the file
+ * format.
+ */
+
+#ifndef FLIGHT_H_
+#define FLIGHT_H_
+
+#include "trace.h"
+
+/* Magic number at the start of a flight recorder file */
+#define FLIGHT_MAGIC "SOFLGHT2"
+
+/* Time between the two clock readings of flight_open, in ns */
+#define FLIGHT_CALIBRATE_NS 1000000
+
+/* Value of task_slot_t.io when the task does not wait for an io */
+#define FLIGHT_NO_IO 0xFFFF
+
+/* File header, followed by the records, then by the task slots */
+typedef struct flight_hdr_t flight_hdr_t;
+struct flight_hdr_t {
+	char magic[8];
+	uint32_t rec_size;
+	uint32_t slot_size;
+	/* Capacity of the ring, a power of two */
+	uint64_t records;
+	/* Number of task slots, a power of two */
+	uint64_t slots;
+	/* Number of records written since the start */
+	uint64_t head;
+	/*
+	 * Clock readings converting the timestamps to ns, see trace_ns: at the
+	 * start and FLIGHT_CALIBRATE_NS later, the second one is read again by
+	 * flight_close
+	 */
+	trace_clock_t clock[2];
+};
+
+/* Last known state of a task, task seq lives in slot seq % slots */
+typedef struct task_slot_t task_slot_t;
+struct task_slot_t {
+	/* Sequence id of the task, 0 for an unused slot */
+	uint32_t seq;
+	/* Name of the task */
+	char name[TRACE_NAME_LEN];
+	/* READY, RUNNING, WAITING or TERMINATED, in this order */
+	uint8_t state;
+	/* Priority of the task */
+	uint8_t prio;
+	/* Io the task waits for or FLIGHT_NO_IO */
+	uint16_t io;
+	/* Time quantum left */
+	int32_t time_quantum;
+	/* Sequence id of the parent, 0 for a task forked from outside */
+	uint32_t parent;
+	/* Timestamp counter of the last update, see flight_hdr_t.clock */
+	uint64_t ts;
+};
+
+typedef struct flight_t flight_t;
+struct flight_t {
+	/* Start of the mapping */
+	flight_hdr_t *hdr;
+	/* Trace ring over the mapped records */
+	trace_ring_t *ring;
+	/* Mapped task slots */
+	task_slot_t *slots;
+	/* Size of the mapping */
+	size_t size;
+};
+
+flight_t *flight_open(const char *path, unsigned int records, unsigned int slots);
+
+task_slot_t *flight_slot(flight_t *flight, unsigned int seq);
+
+void flight_close(flight_t *flight);
+
+#endif /* FLIGHT_H_ */
@@ -0,0 +1,69 @@
+#include "histogram.h"
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static int hist_index(unsigned long long value)
+{
+	int shift;
+
+	if (value < HIST_SUB)
+		return value;
+
+	/* The HIST_SUB_BITS bits under the leading one select the bucket */
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+/* Highest value falling in a bucket */
+static unsigned long long hist_highest(int index)
+{
+	int shift;
+
+	if (index < HIST_SUB)
+		return index;
+
+	shift = index / HIST_SUB - 1;
+	return ((unsigned long long)(HIST_SUB + index % HIST_SUB + 1) << shift) - 1;
+}
+
+void hist_init(histogram_t *hist)
+{
+	memset(hist, 0, sizeof(histogram_t));
+	hist->min = ~0ULL;
+}
+
+/* Single writer */
+void hist_record(histogram_t *hist, unsigned long long value)
+{
+	++hist->buckets[hist_index(value)];
+	++hist->count;
+	hist->sum += value;
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+/* Value under which percentile % of the recorded values fall, 0 if empty */
+unsigned long long hist_percentile(histogram_t *hist, double percentile)
+{
+	unsigned long long count = LOAD(hist->count), seen = 0, rank, max;
+
+	if (!count)
+		return 0;
+
+	/* Rank of the value, 1 based */
+	rank = (unsigned long long)(percentile / 100.0 * count + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (int i = 0; i != HIST_BUCKETS; ++i) {
+		seen += LOAD(hist->buckets[i]);
+		if (seen >= rank) {
+			max = LOAD(hist->max);
+			return hist_highest(i) < max ? hist_highest(i) : max;
+		}
+	}
+
+	return LOAD(hist->max);
+}
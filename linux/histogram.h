@@ -0,0 +1,38 @@
+/**
+ * Log-linear latency histogram, in the spirit of HdrHistogram.
+ * Each power of two range is split in HIST_SUB equal buckets, so any
+ * value is kept with a relative error under 1 / HIST_SUB in a fixed
+ * array covering the whole 64 bit range. Recording is a few bit
+ * operations and an increment, with a single writer. Readers may run
+ * concurrently, every counter is loaded as a whole.
+ */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include "utils.h"
+
+/* log2 of the number of buckets per power of two */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct histogram_t histogram_t;
+struct histogram_t {
+	/* Number of recorded values */
+	unsigned long long count;
+	/* Extremes and sum of the recorded values */
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long sum;
+	/* Number of recorded values per bucket */
+	unsigned long long buckets[HIST_BUCKETS];
+};
+
+void hist_init(histogram_t *hist);
+
+void hist_record(histogram_t *hist, unsigned long long value);
+
+unsigned long long hist_percentile(histogram_t *hist, double percentile);
+
+#endif /* HISTOGRAM_H_ */
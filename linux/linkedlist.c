@@ -27,6 +27,7 @@ void add_node(LinkedList *list, int nth_node, void *new_data)
 	/* Add last position */
 	if (nth_node >= list->size) {
 		++list->size;
+		new_node->prev = list->back;
 		list->back->next = new_node;
 		list->back = new_node;
 		new_node->data = new_data;
@@ -42,7 +43,9 @@ void add_node(LinkedList *list, int nth_node, void *new_data)
 	}
 
 	new_node->next = curr;
+	new_node->prev = prev;
 	new_node->data = new_data;
+	curr->prev = new_node;
 
 	++list->size;
 
@@ -79,19 +82,60 @@ void *remove_node(LinkedList *list, int nth_node)
 	}
 
 	--list->size;
-	if (!prev)
+	if (!prev) {
 		list->head = curr->next;
-	else {
+		list->head->prev = NULL;
+	} else {
 		if (curr == list->back) {
 			list->back = prev;
 			prev->next = NULL;
-		} else
+		} else {
 			prev->next = curr->next;
+			curr->next->prev = prev;
+		}
 	}
 
 	return curr;
 }
 
+/* Append a caller-owned node at the back of the list, no allocation involved */
+void link_node(LinkedList *list, Node *node)
+{
+	if (!list || !node)
+		return;
+
+	node->next = NULL;
+	node->prev = list->back;
+
+	if (!list->size)
+		list->head = node;
+	else
+		list->back->next = node;
+
+	list->back = node;
+	++list->size;
+}
+
+/* Detach a node known to be in the list in O(1). The node is not free'd */
+void unlink_node(LinkedList *list, Node *node)
+{
+	if (!list || !node || !list->size)
+		return;
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		list->head = node->next;
+
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		list->back = node->prev;
+
+	node->next = node->prev = NULL;
+	--list->size;
+}
+
 void *get_node(LinkedList *list, int nth_node)
 {
 	Node *curr;
@@ -13,6 +13,7 @@
 typedef struct Node Node;
 struct Node {
 	Node *next;
+	Node *prev;
 	void *data;
 };
 
@@ -28,6 +29,10 @@ void list_init(LinkedList *list, void (*free_func)(void *));
 
 void add_node(LinkedList *list, int nth_node, void *new_data);
 
+void link_node(LinkedList *list, Node *node);
+
+void unlink_node(LinkedList *list, Node *node);
+
 void *remove_node(LinkedList *list, int nth_node);
 
 void *get_node(LinkedList *list, int nth_node);
@@ -0,0 +1,57 @@
+#include <stddef.h>
+
+#include "mpsc_queue.h"
+
+void mpsc_init(mpsc_queue_t *queue)
+{
+	atomic_store_explicit(&queue->stub.next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&queue->tail, &queue->stub, memory_order_relaxed);
+	queue->head = &queue->stub;
+}
+
+/* Safe from any thread, the node is visible to the consumer once linked */
+void mpsc_push(mpsc_queue_t *queue, mpsc_node_t *node)
+{
+	mpsc_node_t *prev;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	prev = atomic_exchange_explicit(&queue->tail, node, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/*
+ * Consumer only. Returns NULL when the queue is empty or when a producer
+ * is between its exchange and its link, the node shows up at a later pop.
+ */
+mpsc_node_t *mpsc_pop(mpsc_queue_t *queue)
+{
+	mpsc_node_t *head = queue->head;
+	mpsc_node_t *next = atomic_load_explicit(&head->next, memory_order_acquire);
+
+	/* Skip the stub */
+	if (head == &queue->stub) {
+		if (!next)
+			return NULL;
+		queue->head = next;
+		head = next;
+		next = atomic_load_explicit(&head->next, memory_order_acquire);
+	}
+
+	if (next) {
+		queue->head = next;
+		return head;
+	}
+
+	if (head != atomic_load_explicit(&queue->tail, memory_order_acquire))
+		return NULL;
+
+	/* head is the last node, put the stub behind it before handing it out */
+	mpsc_push(queue, &queue->stub);
+	next = atomic_load_explicit(&head->next, memory_order_acquire);
+	if (next) {
+		queue->head = next;
+		return head;
+	}
+
+	return NULL;
+}
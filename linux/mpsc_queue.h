@@ -0,0 +1,34 @@
+/**
+ * Intrusive multi-producer single-consumer queue (Vyukov).
+ * Any thread can push with a single atomic exchange and no lock, while
+ * only one thread at a time pops. Elements are linked through
+ * caller-owned nodes and the queue does not own them.
+ */
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <stdatomic.h>
+
+typedef struct mpsc_node_t mpsc_node_t;
+struct mpsc_node_t {
+	mpsc_node_t *_Atomic next;
+};
+
+typedef struct mpsc_queue_t mpsc_queue_t;
+struct mpsc_queue_t {
+	/* Last pushed node, shared by the producers */
+	mpsc_node_t *_Atomic tail;
+	/* Next node to pop, owned by the consumer */
+	mpsc_node_t *head;
+	/* Placeholder keeping the queue non empty */
+	mpsc_node_t stub;
+};
+
+void mpsc_init(mpsc_queue_t *queue);
+
+void mpsc_push(mpsc_queue_t *queue, mpsc_node_t *node);
+
+mpsc_node_t *mpsc_pop(mpsc_queue_t *queue);
+
+#endif /* MPSC_QUEUE_H_ */
@@ -0,0 +1,36 @@
+/**
+ * USDT probes (provider so_scheduler) at every scheduling transition.
+ * A probe is a single nop plus a note in the ELF file until a tracer
+ * such as bpftrace or perf attaches to it. They are built in whenever
+ * <sys/sdt.h> (systemtap-sdt-dev) is installed, unless SO_NO_USDT is
+ * defined, and expand to nothing otherwise. Every probe gets the tid,
+ * priority, state and remaining quantum of the task and the number of
+ * ready tasks; wait and signal get the io as a sixth argument.
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/* The quoted form falls back to the system directories like <sys/sdt.h> */
+#if !defined(SO_NO_USDT) && defined(__has_include)
+#if __has_include("sys/sdt.h")
+#include <sys/sdt.h>
+#define SO_USDT
+#endif
+#endif
+
+#ifdef SO_USDT
+#define SO_PROBE(name, scheduler, thread)					\
+	DTRACE_PROBE5(so_scheduler, name, (thread)->tid, (thread)->priority,	\
+		      (thread)->state, (thread)->time_quantum,			\
+		      (scheduler)->ready->size)
+#define SO_PROBE_IO(name, scheduler, thread, io)				\
+	DTRACE_PROBE6(so_scheduler, name, (thread)->tid, (thread)->priority,	\
+		      (thread)->state, (thread)->time_quantum,			\
+		      (scheduler)->ready->size, io)
+#else
+#define SO_PROBE(name, scheduler, thread) do { } while (0)
+#define SO_PROBE_IO(name, scheduler, thread, io) do { } while (0)
+#endif
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,20 @@
+#include "so_scheduler.h"
+
+/*
+ * Hooks called by code built with -finstrument-functions. Always built
+ * with -O2: the entry hook is a decrement and a branch on the TLS budget
+ */
+__attribute__((no_instrument_function))
+void __cyg_profile_func_enter(void *func, void *call_site)
+{
+	(void)func;
+	(void)call_site;
+	SO_CHECKPOINT();
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_exit(void *func, void *call_site)
+{
+	(void)func;
+	(void)call_site;
+}
@@ -1,10 +1,41 @@
+#define _GNU_SOURCE
+#include <limits.h>
 #include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "so_scheduler.h"
-#include "prio_queue.h"
+#include "bucket_queue.h"
+#include "task_table.h"
+#include "mpsc_queue.h"
+#include "flight.h"
+#include "histogram.h"
+#include "probes.h"
 
 #define SO_FAIL -1
 
+/* Signal sent by the per-thread CPU timers in preemptive mode */
+#define PREEMPT_SIGNAL (SIGRTMIN + 1)
+
+/* Older glibc headers do not name the thread id field of struct sigevent */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* Records a scheduling event of a thread when tracing is on */
+#define TRACE(scheduler, type, thread, arg)				\
+	do {								\
+		if ((scheduler)->trace)					\
+			trace_event(scheduler, type, thread, arg);	\
+	} while (0)
+
+/* Keeps timer preemption off until the end of the enclosing scope */
+#define PREEMPT_GUARD() \
+	int preempt_guard __attribute__((cleanup(preempt_leave))) = preempt_enter()
+
 /* Enum representing the possible states a thread can find itself in */
 typedef enum {
 	READY,
@@ -13,244 +44,1741 @@ typedef enum {
 	TERMINATED
 } thread_state_t;
 
+typedef so_sched_t scheduler_t;
+
 /* Thread wrapper */
-typedef struct {
+typedef struct thread_t {
 	tid_t tid; /* Pthread id */
+	unsigned int seq; /* Sequence id, 1 for the first fork of the scheduler */
+	char name[SO_TASK_NAME_LEN]; /* Name of the pthread, see so_fork_named */
+	scheduler_t *scheduler; /* Scheduler owning the thread */
 	so_handler *handler; /* Function handler */
+	so_handler_arg *handler_arg; /* Function handler taking a user argument */
+	void *arg; /* User argument passed to handler_arg */
 	thread_state_t state; /* Current thread state */
 	int time_quantum; /* Time left on the processor while running */
 	int priority; /* Thread priority */
 
+	/* CPU time accounting, updated at every scheduling point in ns mode */
+	unsigned long long cpu_ns; /* CPU time consumed by the thread */
+	unsigned long long cpu_stamp; /* Thread CPU clock at the last accounting */
+	unsigned long long slice_ns; /* CPU time used from the current quantum */
+
+	/* Statistics, see so_get_stats */
+	unsigned long long ticks_run; /* Units charged to the thread */
+	unsigned long long ticks_ready; /* Scheduler ticks spent in the ready queue */
+	unsigned long long ticks_waiting; /* Scheduler ticks spent waiting */
+	unsigned long long dispatches; /* Number of times the thread was planned */
+	unsigned long long stamp; /* Scheduler tick of the last state change */
+
+	/* Latency measurements, CLOCK_MONOTONIC in ns, see so_latency_start */
+	unsigned long long ready_ns; /* Time the thread entered the ready queue */
+	unsigned long long post_ns; /* Time its semaphore was posted by plan_next */
+	unsigned long long signal_ns; /* Time of the signal which woke it up */
+
+	/* Back-pointer into the ready bucket or the waiting list holding the thread */
+	struct Node node;
+
+	LinkedList *wait_list; /* Waiting list of the io the thread waits for */
+	struct thread_t *joiner; /* Thread parked in so_join until this one ends */
+	struct thread_t *join_target; /* Thread this one is parked on in so_join */
+	struct thread_t *parent; /* Thread which forked this one */
+	LinkedList children; /* Threads forked by this one and not reaped yet */
+	Node sibling; /* Link in the children list of the parent */
+	LinkedList exit_cbs; /* Callbacks registered through so_on_exit */
+	int cancelled; /* Set by so_cancel, the thread unwinds at its next scheduling point */
+	int exiting; /* Running its exit callbacks, which may call so_* freely */
+
+	/* Preemptive mode */
+	timer_t timer; /* CPU time timer raising PREEMPT_SIGNAL when the quantum is spent */
+	volatile sig_atomic_t preempt_off; /* Nesting count of sections the timer can't preempt */
+	volatile sig_atomic_t preempt_pending; /* Timer expired, handoff at the next safe point */
+
 	/* Synchronization elements */
 	sem_t running; /* Used for blocking a thread when it is preempted */
 } thread_t;
 
-/* Scheduler info */
+/* Callback registered through so_on_exit */
+typedef struct {
+	so_exit_cb *cb;
+	void *arg;
+} exit_cb_t;
+
+/* Per-task counters asked for by a thread other than the running one */
+typedef struct {
+	so_task_stats_t *tasks; /* Where the counters are copied */
+	unsigned int n; /* Size of tasks */
+	int cnt; /* Return value of so_get_stats */
+	sem_t done; /* Posted by the scheduling point which copied them */
+} stats_req_t;
+
+/* Signal posted through so_signal_external */
 typedef struct {
+	mpsc_node_t node; /* Link in the inbox, first so a popped node is the signal */
+	unsigned int io; /* Device to signal */
+	unsigned long long sent_ns; /* Time it was posted */
+} ext_signal_t;
+
+/* Scheduler info */
+struct so_sched {
 	int time_quantum; /* Max allowed time quantum */
+	unsigned long long quantum_ns; /* CPU time quantum in ns, 0 when counting so_exec calls */
+	int preemptive; /* Threads are preempted by CPU timers, see so_init_preemptive */
+	long checkpoint_interval; /* SO_CHECKPOINT calls worth one so_exec */
+	struct sigaction old_action; /* PREEMPT_SIGNAL action before so_init_preemptive */
 	int io; /* Max number of io devices */
 	int no_threads; /* Number of threads handled by the scheduler */
+	int alive; /* Threads which did not terminate yet */
 
 	thread_t *thread; /* Pointer to the currently running thread */
-	prio_queue_t *ready; /* Threads which are waiting to be planned */
-	prio_queue_t *finished; /* Threads which finished their job and are waiting to be free'd */
-	prio_queue_t **waiting; /* Blocked threads by an event */
+	bucket_queue_t *ready; /* Threads which are waiting to be planned */
+	LinkedList finished; /* Threads which finished their job and are waiting to be free'd */
+	LinkedList *waiting; /* Blocked threads by an event, one FIFO per io */
+	task_table_t *tasks; /* Every forked thread by tid, owns the thread memory */
+	trace_ring_t *trace; /* Recent scheduling events, NULL while tracing is off */
+	flight_t *flight; /* Flight recorder file holding the trace, see so_flight_record */
+	int trace_fd; /* Where so_destroy writes the trace, -1 for nowhere */
+	so_stats_t stats; /* Counters, only written by the running thread */
+	histogram_t *latency; /* One histogram per SO_LATENCY_* kind, NULL while off */
+	mpsc_queue_t inbox; /* Signals from outside the scheduler, drained at scheduling points */
+
+	/* Idle state, see idle_wait */
+	int idle_fd; /* eventfd the scheduler sleeps on while nothing can run */
+	atomic_int idle; /* Set while sleeping on idle_fd, producers then write to it */
+	atomic_int sources; /* Threads attached through so_attach_source */
+	atomic_int dump_fd; /* Where the next scheduling point writes a dump, -1 for none */
+
+	/* Per-task counters asked for by other threads, see serve_stats */
+	stats_req_t *_Atomic stats_req; /* Copied by the next scheduling point */
+	pthread_mutex_t stats_lock; /* One pending stats_req at a time */
+	atomic_int ended; /* Set once the last thread terminated, no scheduling point is left */
 
 	/* Synchronization elements */
 	sem_t end; /* Used for signaling when the scheduler should stop */
-} scheduler_t;
+};
+
+/* Instance behind so_init and so_end, used by the so_* calls outside the tasks */
+scheduler_t *default_scheduler;
+
+/*
+ * Thread wrapper of the calling thread, NULL outside the scheduled threads.
+ * Initial exec, like so_checkpoint_budget: one %fs load instead of a call
+ * to __tls_get_addr, the library is never dlopen'ed late
+ */
+static __thread thread_t *current_thread __attribute__((tls_model("initial-exec")));
+
+/* SO_CHECKPOINT calls left before the calling thread checks its quantum, zeroed by the timer */
+__thread volatile long so_checkpoint_budget = LONG_MAX;
 
-scheduler_t *scheduler;
+/* Instance dumped on SIGUSR2 and where to, see so_dump_on_signal */
+static scheduler_t *dump_signal_sched;
+static int dump_signal_fd;
+static struct sigaction dump_old_action;
+
+static const char * const state_names[] = {
+	"READY", "RUNNING", "WAITING", "TERMINATED"
+};
 
 void mark_as_ready(thread_t *thread);
 
-void plan_next(void);
+void plan_next(scheduler_t *scheduler);
 
-void scheduler_check(void);
+void scheduler_check(scheduler_t *scheduler);
 
-/* Cmp func used by the prio_queue for inserting the elements */
-int cmp_func(const void *t1, const void *t2)
-{
-	return ((thread_t *)t1)->priority - ((thread_t *)t2)->priority;
-}
+void reschedule(scheduler_t *scheduler, unsigned int units);
+
+void task_exit(thread_t *thread);
+
+void cancel_point(scheduler_t *scheduler);
+
+void trace_event(scheduler_t *scheduler, int type, thread_t *thread, int arg);
+
+int preempt_enter(void);
+
+void preempt_leave(int *guard);
 
-/* Free func used by the prio_queue for freeing up the memory used by a thread */
+/* Free func used by the task table for freeing up the memory used by a thread */
 void free_func(void *t)
 {
+	Node *node;
+
 	/* Wait for the thread to finish and free the semaphore memory */
 	DIE(pthread_join(((thread_t *)t)->tid, NULL), "pthread_join failed!");
 	DIE(sem_destroy(&((thread_t *)t)->running), "sem_destroy failed!");
 
+	/* Callbacks of threads that never got to run */
+	while ((node = remove_node(&((thread_t *)t)->exit_cbs, 0))) {
+		free(node->data);
+		free(node);
+	}
+
 	free(t);
 }
 
-/* Gets the next ready thread from the queue and sets its state to RUNNING */
-void plan_next(void)
+/* Releases a terminated thread before so_end */
+void reap_thread(thread_t *thread)
 {
-	scheduler->thread = queue_pop(scheduler->ready);
-	scheduler->thread->state = RUNNING;
-	scheduler->thread->time_quantum = scheduler->time_quantum;
-	/* Signal the thread it is okay to start execution */
-	DIE(sem_post(&scheduler->thread->running), "sem_post failed!");
+	scheduler_t *scheduler = thread->scheduler;
+	Node *node;
+
+	unlink_node(&scheduler->finished, &thread->node);
+	table_remove(scheduler->tasks, thread->tid);
+
+	/* Hand the children over to the grandparent */
+	while (thread->children.size) {
+		node = thread->children.head;
+		unlink_node(&thread->children, node);
+		((thread_t *)node->data)->parent = thread->parent;
+		if (thread->parent)
+			link_node(&thread->parent->children, node);
+	}
+	if (thread->parent)
+		unlink_node(&thread->parent->children, &thread->sibling);
+
+	free_func(thread);
 }
 
-/* Scheduling logic function. It handles all the possible cases */
-void scheduler_check(void)
+/* Takes a WAITING thread off the io list or the join it is parked on */
+void detach_waiting(thread_t *thread)
 {
-	thread_t *current = scheduler->thread;
+	if (thread->join_target) {
+		thread->join_target->joiner = NULL;
+		thread->join_target = NULL;
+	} else {
+		unlink_node(thread->wait_list, &thread->node);
+	}
+}
 
-	if (!queue_size(scheduler->ready)) {
-		if (current->state == TERMINATED)
-			/* Signal the scheduler to stop */
-			DIE(sem_post(&scheduler->end), "sem_post failed!");
-		/* Signal the current thread it can still run */
-		DIE(sem_post(&current->running), "sem_post failed!");
-		return;
+/* Marks a thread as cancelled and wakes it up so it can unwind */
+void cancel_thread(thread_t *thread)
+{
+	thread->cancelled = 1;
+
+	if (thread->state == WAITING) {
+		detach_waiting(thread);
+		mark_as_ready(thread);
 	}
+}
+
+/* Checks if thread is in the subtree forked by root */
+int descends_from(thread_t *thread, thread_t *root)
+{
+	for (; thread; thread = thread->parent)
+		if (thread == root)
+			return 1;
+
+	return 0;
+}
+
+/* Terminates the current thread if it was cancelled */
+void cancel_point(scheduler_t *scheduler)
+{
+	if (scheduler->thread->cancelled && !scheduler->thread->exiting)
+		task_exit(scheduler->thread);
+}
+
+/* Gets the thread_t behind a tid or NULL if the tid is unknown */
+thread_t *find_thread(scheduler_t *scheduler, tid_t tid)
+{
+	return table_find(scheduler->tasks, tid);
+}
+
+/* CPU time consumed by the calling thread */
+unsigned long long thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	DIE(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts), "clock_gettime failed!");
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long mono_ns(void)
+{
+	struct timespec ts;
 
-	if (!current || current->state == WAITING) {
-		plan_next();
+	DIE(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime failed!");
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Records the latencies ending when a thread gets the processor back */
+void latency_resumed(thread_t *thread)
+{
+	histogram_t *latency = thread->scheduler->latency;
+	unsigned long long now;
+
+	/* Not a handoff from plan_next, the thread just kept running */
+	if (!latency || !thread->post_ns)
 		return;
+
+	now = mono_ns();
+	hist_record(&latency[SO_LATENCY_DISPATCH], now - thread->post_ns);
+	thread->post_ns = 0;
+
+	if (thread->signal_ns) {
+		hist_record(&latency[SO_LATENCY_SIGNAL], now - thread->signal_ns);
+		thread->signal_ns = 0;
 	}
+}
 
-	if (current->state == TERMINATED) {
-		queue_push(scheduler->finished, current);
-		plan_next();
+/* sem_wait which is not cut short by PREEMPT_SIGNAL */
+void wait_turn(sem_t *sem)
+{
+	while (sem_wait(sem))
+		DIE(errno != EINTR, "sem_wait failed!");
+}
+
+/* Starts the CPU timer of the calling thread for what is left of its quantum */
+void arm_timer(thread_t *thread)
+{
+	struct itimerspec its = { 0 };
+	unsigned long long quantum_ns = thread->scheduler->quantum_ns;
+	unsigned long long left = 1;
+
+	if (thread->slice_ns < quantum_ns)
+		left = quantum_ns - thread->slice_ns;
+
+	its.it_value.tv_sec = left / 1000000000ULL;
+	its.it_value.tv_nsec = left % 1000000000ULL;
+	DIE(timer_settime(thread->timer, 0, &its, NULL), "timer_settime failed!");
+}
+
+/* Hands the processor over once the CPU timer of the thread expired */
+void preempt(thread_t *thread)
+{
+	++thread->preempt_off;
+	thread->time_quantum = 0;
+	reschedule(thread->scheduler, 0);
+	--thread->preempt_off;
+}
+
+/* PREEMPT_SIGNAL handler, runs on the thread whose timer expired */
+void preempt_handler(int signo)
+{
+	thread_t *thread = current_thread;
+
+	(void)signo;
+	if (!thread || thread != thread->scheduler->thread || thread->state != RUNNING)
 		return;
-	}
 
-	if (current->priority < ((thread_t *)queue_top(scheduler->ready))->priority) {
-		mark_as_ready(current);
-		plan_next();
+	/*
+	 * The thread might hold a libc lock the next one needs, so the
+	 * handoff waits for a safe point: the end of the next so_* call, or
+	 * the next SO_CHECKPOINT, which the spent budget sends to the slow path
+	 */
+	thread->preempt_pending = 1;
+	so_checkpoint_budget = 0;
+}
+
+int preempt_enter(void)
+{
+	if (current_thread)
+		++current_thread->preempt_off;
+
+	return 0;
+}
+
+void preempt_leave(int *guard)
+{
+	thread_t *thread = current_thread;
+
+	(void)guard;
+	if (!thread || --thread->preempt_off || !thread->preempt_pending)
+		return;
+
+	thread->preempt_pending = 0;
+	if (thread == thread->scheduler->thread && thread->state == RUNNING)
+		preempt(thread);
+}
+
+/* Gives the thread a full time quantum */
+void refill_quantum(thread_t *thread)
+{
+	thread->time_quantum = thread->scheduler->time_quantum;
+	thread->slice_ns = 0;
+}
+
+/* Charges units of work to the running thread, must be called by that thread */
+void charge(thread_t *thread, unsigned int units)
+{
+	scheduler_t *scheduler = thread->scheduler;
+	unsigned long long now;
+
+	scheduler->stats.ticks += units;
+	thread->ticks_run += units;
+
+	if (!scheduler->quantum_ns) {
+		thread->time_quantum -= units;
 		return;
 	}
 
-	if (!current->time_quantum) {
-		if (current->priority == ((thread_t *)queue_top(scheduler->ready))->priority) {
-			mark_as_ready(current);
-			plan_next();
-			return;
-		}
-		current->time_quantum = scheduler->time_quantum;
+	/* The quantum is a single tick, spent once the CPU budget runs out */
+	now = thread_cpu_ns();
+	thread->cpu_ns += now - thread->cpu_stamp;
+	thread->slice_ns += now - thread->cpu_stamp;
+	thread->cpu_stamp = now;
+
+	if (thread->slice_ns >= scheduler->quantum_ns)
+		thread->time_quantum = 0;
+}
+
+/* Moves every thread waiting for io to the ready queue, sent_ns is the signal time */
+int wake_io(scheduler_t *scheduler, unsigned int io, unsigned long long sent_ns)
+{
+	Node *node;
+	int cnt;
+
+	for (cnt = 0; (node = scheduler->waiting[io].head); ++cnt) {
+		unlink_node(&scheduler->waiting[io], node);
+		((thread_t *)node->data)->signal_ns = sent_ns;
+		mark_as_ready(node->data);
 	}
-	/* The current thread can still run */
-	DIE(sem_post(&current->running), "sem_post failed!");
+
+	++scheduler->stats.signals;
+	scheduler->stats.wakeups += cnt;
+	return cnt;
 }
 
-/* Add thread to ready queue */
-void mark_as_ready(thread_t *thread)
+/* Delivers the signals posted by so_signal_external since the last call */
+void drain_inbox(scheduler_t *scheduler)
 {
-	thread->state = READY;
-	queue_push(scheduler->ready, thread);
+	mpsc_node_t *node;
+
+	while ((node = mpsc_pop(&scheduler->inbox))) {
+		/* Not sent by a task, recorded with the sequence id 0 */
+		if (scheduler->trace)
+			trace_add(scheduler->trace, TRACE_SIGNAL, 0, 0, ((ext_signal_t *)node)->io);
+		wake_io(scheduler, ((ext_signal_t *)node)->io, ((ext_signal_t *)node)->sent_ns);
+		free(node);
+	}
 }
 
-int so_init(unsigned int time_quantum, unsigned int io)
+/* Copies the state of a thread to its flight recorder slot */
+void flight_update(thread_t *thread)
 {
-	if (scheduler || io > SO_MAX_NUM_EVENTS || !time_quantum)
-		return SO_FAIL;
+	scheduler_t *scheduler = thread->scheduler;
+	trace_ring_t *ring = scheduler->trace;
+	task_slot_t *slot = flight_slot(scheduler->flight, thread->seq);
 
-	DIE(!(scheduler = calloc(1, sizeof(scheduler_t))), "scheduler calloc!");
-	DIE(sem_init(&scheduler->end, 0, 0), "sem_init failed!");
+	slot->seq = thread->seq;
+	memcpy(slot->name, thread->name, sizeof(slot->name));
+	slot->state = thread->state;
+	slot->prio = thread->priority;
+	slot->io = FLIGHT_NO_IO;
+	if (thread->state == WAITING && !thread->join_target)
+		slot->io = thread->wait_list - scheduler->waiting;
+	slot->time_quantum = thread->time_quantum;
+	slot->parent = thread->parent ? thread->parent->seq : 0;
+	/* Time of the latest event, a clock read per update would double the cost */
+	slot->ts = ring->recs[(*ring->head - 1) & ring->mask].ts;
+}
 
-	scheduler->time_quantum = time_quantum;
-	scheduler->io = io;
-	scheduler->ready = queue_init(cmp_func, free_func);
-	scheduler->finished = queue_init(cmp_func, free_func);
+void trace_event(scheduler_t *scheduler, int type, thread_t *thread, int arg)
+{
+	trace_add(scheduler->trace, type, thread->seq, thread->priority, arg);
 
-	scheduler->waiting = calloc(io, sizeof(prio_queue_t *));
-	DIE(!scheduler->waiting, "Failed to calloc array of waiting queues!");
+	if (scheduler->flight)
+		flight_update(thread);
+}
 
-	for (int i = 0; i != (int)io; ++i)
-		scheduler->waiting[i] = queue_init(cmp_func, free_func);
+/* Wakes the scheduler up if it sleeps in idle_wait, called after publishing work */
+void wake_idle(scheduler_t *scheduler)
+{
+	/* Pairs with the fence in idle_wait, one of the sides sees the other */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&scheduler->idle))
+		DIE(eventfd_write(scheduler->idle_fd, 1), "eventfd_write failed!");
+}
 
-	return 0;
+/* Text snapshot of the queues and of every task, *len gets its length */
+char *snapshot(scheduler_t *scheduler, size_t *len)
+{
+	thread_t *thread;
+	Node *node;
+	FILE *out;
+	char *buf;
+
+	DIE(!(out = open_memstream(&buf, len)), "open_memstream failed!");
+
+	fprintf(out, "scheduler tasks %d alive %d ready %d ticks %llu running %u\n",
+		table_size(scheduler->tasks), scheduler->alive, bqueue_size(scheduler->ready),
+		scheduler->stats.ticks, scheduler->thread ? scheduler->thread->seq : 0);
+
+	/* Queues in planning order, by sequence id */
+	for (int prio = SO_MAX_PRIO; prio >= 0; --prio) {
+		if (!scheduler->ready->buckets[prio].head)
+			continue;
+		fprintf(out, "ready prio %d:", prio);
+		for (node = scheduler->ready->buckets[prio].head; node; node = node->next)
+			fprintf(out, " %u", ((thread_t *)node->data)->seq);
+		fputc('\n', out);
+	}
+
+	for (int io = 0; io != scheduler->io; ++io) {
+		if (!scheduler->waiting[io].head)
+			continue;
+		fprintf(out, "waiting io %d:", io);
+		for (node = scheduler->waiting[io].head; node; node = node->next)
+			fprintf(out, " %u", ((thread_t *)node->data)->seq);
+		fputc('\n', out);
+	}
+
+	if (scheduler->finished.head) {
+		fprintf(out, "finished:");
+		for (node = scheduler->finished.head; node; node = node->next)
+			fprintf(out, " %u", ((thread_t *)node->data)->seq);
+		fputc('\n', out);
+	}
+
+	for (int i = 0; i != table_size(scheduler->tasks); ++i) {
+		thread = table_get(scheduler->tasks, i);
+		fprintf(out, "task %u %s %s prio %d quantum %d parent %u", thread->seq,
+			thread->name, state_names[thread->state], thread->priority, thread->time_quantum,
+			thread->parent ? thread->parent->seq : 0);
+		if (thread->state == WAITING && thread->join_target)
+			fprintf(out, " join %u", thread->join_target->seq);
+		else if (thread->state == WAITING)
+			fprintf(out, " io %d", (int)(thread->wait_list - scheduler->waiting));
+		if (thread->cancelled)
+			fprintf(out, " cancelled");
+		fputc('\n', out);
+	}
+
+	DIE(fclose(out), "fclose failed!");
+	return buf;
 }
 
-void *start_thread(void *args)
+/* Writes and frees a snapshot, errors are dropped, nobody is left to report them */
+void write_dump(int fd, char *buf, size_t len)
 {
-	/* The thread should block here and wait until has the right to execute */
-	DIE(sem_wait(&((thread_t *)args)->running), "sem_wait failed!.");
+	ssize_t ret;
 
-	/* Thread runs its tasks via handler */
-	((thread_t *)args)->handler(((thread_t *)args)->priority);
+	for (size_t done = 0; done != len; done += ret) {
+		ret = write(fd, buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			ret = 0;
+		else if (ret <= 0)
+			break;
+	}
 
-	/* Thread finished its tasks. Mark the thread as terminated */
-	((thread_t *)args)->state = TERMINATED;
+	free(buf);
+}
 
-	/* Call the scheduler */
-	scheduler_check();
+/* Snapshot asked for through so_dump_state, NULL if there is none */
+char *take_dump(scheduler_t *scheduler, size_t *len, int *fd)
+{
+	if (atomic_load_explicit(&scheduler->dump_fd, memory_order_relaxed) < 0)
+		return NULL;
 
-	pthread_exit(NULL);
+	*fd = atomic_exchange(&scheduler->dump_fd, -1);
+	return *fd < 0 ? NULL : snapshot(scheduler, len);
 }
 
-tid_t so_fork(so_handler *func, unsigned int priority)
+/* Asks the thread owning the scheduler for a dump, async-signal-safe */
+void request_dump(scheduler_t *scheduler, int fd)
 {
+	atomic_store(&scheduler->dump_fd, fd);
+	wake_idle(scheduler);
+}
+
+/* Copies the per-task counters, only the running thread can walk the table */
+int copy_task_stats(scheduler_t *scheduler, so_task_stats_t *tasks, unsigned int n)
+{
+	unsigned long long ticks = scheduler->stats.ticks;
+	unsigned int cnt = table_size(scheduler->tasks);
 	thread_t *thread;
 
-	if (!func || priority > SO_MAX_PRIO)
-		return INVALID_TID;
+	for (unsigned int i = 0; i != cnt && i != n; ++i) {
+		thread = table_get(scheduler->tasks, i);
+		tasks[i].tid = thread->tid;
+		tasks[i].seq = thread->seq;
+		memcpy(tasks[i].name, thread->name, sizeof(tasks[i].name));
+		tasks[i].priority = thread->priority;
+		tasks[i].ticks_run = thread->ticks_run;
+		tasks[i].ticks_ready = thread->ticks_ready;
+		tasks[i].ticks_waiting = thread->ticks_waiting;
+		tasks[i].dispatches = thread->dispatches;
+		tasks[i].cpu_ns = thread->cpu_ns;
 
-	DIE(!(thread = calloc(1, sizeof(thread_t))), "thread calloc failed!");
-	/* Init and start thread */
-	thread->priority = priority;
-	thread->time_quantum = scheduler->time_quantum;
-	thread->handler = func;
+		/* Time in the current state */
+		if (thread->state == READY)
+			tasks[i].ticks_ready += ticks - thread->stamp;
+		else if (thread->state == WAITING)
+			tasks[i].ticks_waiting += ticks - thread->stamp;
+	}
 
-	DIE(sem_init(&thread->running, 0, 0), "pthread_init failed!");
-	DIE(pthread_create(&thread->tid, NULL, start_thread, thread), "pthread_create failed!");
+	return cnt;
+}
 
-	++scheduler->no_threads;
-	mark_as_ready(thread);
+/* Answers the so_get_stats call of another thread, if one is pending */
+void serve_stats(scheduler_t *scheduler)
+{
+	stats_req_t *req;
 
-	if (scheduler->thread != NULL)
-		so_exec(); /* If fork was called by another thread */
+	if (!atomic_load_explicit(&scheduler->stats_req, memory_order_relaxed))
+		return;
+
+	req = atomic_exchange(&scheduler->stats_req, NULL);
+	if (!req)
+		return;
+
+	req->cnt = copy_task_stats(scheduler, req->tasks, req->n);
+	DIE(sem_post(&req->done), "sem_post failed!");
+}
+
+/* Asks the thread owning the scheduler for the per-task counters and waits for them */
+int request_stats(scheduler_t *scheduler, so_task_stats_t *tasks, unsigned int n)
+{
+	stats_req_t req = { .tasks = tasks, .n = n };
+
+	DIE(sem_init(&req.done, 0, 0), "sem_init failed!");
+	DIE(pthread_mutex_lock(&scheduler->stats_lock), "pthread_mutex_lock failed!");
+	atomic_store(&scheduler->stats_req, &req);
+	wake_idle(scheduler);
+
+	/* The run may end before serving it, then nothing changes the table anymore */
+	if (atomic_load(&scheduler->ended) && atomic_exchange(&scheduler->stats_req, NULL) == &req)
+		req.cnt = copy_task_stats(scheduler, tasks, n);
 	else
-		scheduler_check(); /* If we are the first thread */
+		wait_turn(&req.done);
+	DIE(pthread_mutex_unlock(&scheduler->stats_lock), "pthread_mutex_unlock failed!");
+	DIE(sem_destroy(&req.done), "sem_destroy failed!");
 
-	return thread->tid;
+	return req.cnt;
 }
 
-int so_wait(unsigned int io)
+void dump_handler(int signo)
 {
-	if ((int)io >= scheduler->io)
-		return SO_FAIL;
+	int saved_errno = errno;
 
-	/* Wait for the received signal */
-	scheduler->thread->state = WAITING;
-	queue_push(scheduler->waiting[io], scheduler->thread);
+	(void)signo;
+	if (dump_signal_sched)
+		request_dump(dump_signal_sched, dump_signal_fd);
 
-	so_exec();
-	return 0;
+	errno = saved_errno;
 }
 
-int so_signal(unsigned int io)
+/*
+ * Sleeps until an external signal makes a thread ready. Without attached
+ * sources nothing can ever wake a thread, so the scheduler is deadlocked.
+ */
+void idle_wait(scheduler_t *scheduler)
 {
-	thread_t *aux;
-	int cnt;
+	eventfd_t cnt;
+	size_t len;
+	char *dump;
+	int fd;
 
-	if ((int)io >= scheduler->io)
-		return SO_FAIL;
+	while (!bqueue_size(scheduler->ready)) {
+		if (!atomic_load(&scheduler->sources)) {
+			/* A signal posted before the last detach is in the inbox by now */
+			drain_inbox(scheduler);
+			if (bqueue_size(scheduler->ready))
+				break;
 
-	/* Wake-up all the threads waiting for that specific io */
-	for (cnt = 0; (aux = queue_pop(scheduler->waiting[io])); ++cnt)
-		mark_as_ready(aux);
+			/* Show who waits for what before leaving */
+			dump = snapshot(scheduler, &len);
+			write_dump(STDERR_FILENO, dump, len);
+			errno = EDEADLK;
+			DIE(1, "every task waits and no external source is attached");
+		}
 
-	so_exec();
-	return cnt;
+		++scheduler->stats.idles;
+		if (scheduler->thread) {
+			TRACE(scheduler, TRACE_IDLE, scheduler->thread, 0);
+			SO_PROBE(idle, scheduler, scheduler->thread);
+		}
+
+		/* Publish the idle state before the last look at the inbox */
+		atomic_store(&scheduler->idle, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		drain_inbox(scheduler);
+
+		/* Requests stored before the fence were not seen to wake it up */
+		if (!bqueue_size(scheduler->ready) && !atomic_load(&scheduler->stats_req) &&
+		    atomic_load(&scheduler->dump_fd) < 0)
+			while (eventfd_read(scheduler->idle_fd, &cnt))
+				DIE(errno != EINTR, "eventfd_read failed!");
+
+		atomic_store(&scheduler->idle, 0);
+		drain_inbox(scheduler);
+
+		/* Nothing runs, the requests can be served right away */
+		serve_stats(scheduler);
+		dump = take_dump(scheduler, &len, &fd);
+		if (dump)
+			write_dump(fd, dump, len);
+	}
 }
 
-void so_exec(void)
+/* Gets the next ready thread from the queue and sets its state to RUNNING */
+void plan_next(scheduler_t *scheduler)
 {
-	thread_t *current = scheduler->thread;
+	thread_t *prev = scheduler->thread;
 
-	--current->time_quantum;
+	scheduler->thread = bqueue_pop(scheduler->ready);
+	scheduler->thread->state = RUNNING;
+	refill_quantum(scheduler->thread);
 
-	/* Call the scheduler */
-	scheduler_check();
+	scheduler->thread->ticks_ready += scheduler->stats.ticks - scheduler->thread->stamp;
+	++scheduler->thread->dispatches;
+	if (scheduler->thread != prev)
+		++scheduler->stats.switches;
 
-	/* Wait here if you get preempteed */
-	DIE(sem_wait(&current->running), "sem_wait failed!");
+	if (scheduler->latency) {
+		scheduler->thread->post_ns = mono_ns();
+		/* Unless it was queued before the measurements started */
+		if (scheduler->thread->ready_ns)
+			hist_record(&scheduler->latency[SO_LATENCY_READY],
+				    scheduler->thread->post_ns - scheduler->thread->ready_ns);
+		scheduler->thread->ready_ns = 0;
+	}
+
+	TRACE(scheduler, TRACE_DISPATCH, scheduler->thread, 0);
+	SO_PROBE(dispatch, scheduler, scheduler->thread);
+	/* Signal the thread it is okay to start execution */
+	DIE(sem_post(&scheduler->thread->running), "sem_post failed!");
 }
 
-void so_end(void)
+/* Scheduling logic function. It handles all the possible cases */
+void scheduler_check(scheduler_t *scheduler)
 {
-	if (!scheduler)
+	thread_t *current = scheduler->thread;
+
+	drain_inbox(scheduler);
+
+	/* Every thread left waits, nothing runs until an external signal */
+	if (!bqueue_size(scheduler->ready) && current &&
+	    (current->state == WAITING || (current->state == TERMINATED && scheduler->alive)))
+		idle_wait(scheduler);
+
+	if (!bqueue_size(scheduler->ready)) {
+		if (current->state == TERMINATED) {
+			link_node(&scheduler->finished, &current->node);
+			/* Pairs with the fence in wake_idle, request_stats sees it or is served */
+			atomic_store(&scheduler->ended, 1);
+			atomic_thread_fence(memory_order_seq_cst);
+			serve_stats(scheduler);
+			/* Signal the scheduler to stop */
+			DIE(sem_post(&scheduler->end), "sem_post failed!");
+		} else if (!current->time_quantum) {
+			refill_quantum(current);
+		}
+		SO_PROBE(keep, scheduler, current);
+		/* Signal the current thread it can still run */
+		DIE(sem_post(&current->running), "sem_post failed!");
 		return;
+	}
 
-	/* Wait for all threads to finish */
-	if (scheduler->no_threads)
-		DIE(sem_wait(&scheduler->end), "sem_wait failed!");
+	/* A thread woken by the inbox right as it started waiting is READY here */
+	if (!current || current->state == WAITING || current->state == READY) {
+		plan_next(scheduler);
+		return;
+	}
 
-	if (scheduler->thread)
-		free_func(scheduler->thread);
+	if (current->state == TERMINATED) {
+		link_node(&scheduler->finished, &current->node);
+		plan_next(scheduler);
+		return;
+	}
 
-	queue_free(scheduler->ready);
-	queue_free(scheduler->finished);
-	for (int i = 0; i != (int)scheduler->io; ++i)
-		queue_free(scheduler->waiting[i]);
+	if (current->priority < bqueue_top_prio(scheduler->ready)) {
+		mark_as_ready(current);
+		++scheduler->stats.preempt_prio;
+		SO_PROBE(preempt_prio, scheduler, current);
+		TRACE(scheduler, TRACE_PREEMPT, current, TRACE_PREEMPT_PRIO);
+		plan_next(scheduler);
+		return;
+	}
 
-	DIE(sem_destroy(&scheduler->end), "sem_destroy failed!");
-	free(scheduler->waiting);
-	free(scheduler);
-	scheduler = NULL;
+	if (!current->time_quantum) {
+		if (current->priority == bqueue_top_prio(scheduler->ready)) {
+			mark_as_ready(current);
+			++scheduler->stats.preempt_quantum;
+			SO_PROBE(preempt_quantum, scheduler, current);
+			TRACE(scheduler, TRACE_PREEMPT, current, TRACE_PREEMPT_QUANTUM);
+			plan_next(scheduler);
+			return;
+		}
+		refill_quantum(current);
+	}
+	SO_PROBE(keep, scheduler, current);
+	/* The current thread can still run */
+	DIE(sem_post(&current->running), "sem_post failed!");
+}
+
+/*
+ * Charges units of work, calls the scheduler and blocks the current
+ * thread until it is planned again. Never reached from a signal handler,
+ * both handlers only set flags: the dump and the inbox allocate and free.
+ */
+void reschedule(scheduler_t *scheduler, unsigned int units)
+{
+	thread_t *current = scheduler->thread;
+	size_t len;
+	char *dump;
+	int fd;
+
+	charge(current, units);
+
+	/* A dump is copied before the decision and written once the next thread runs */
+	serve_stats(scheduler);
+	dump = take_dump(scheduler, &len, &fd);
+	scheduler_check(scheduler);
+	if (dump)
+		write_dump(fd, dump, len);
+
+	/* Wait here if you get preempteed */
+	wait_turn(&current->running);
+	latency_resumed(current);
+
+	/* A timer expiry from the previous slice must not cut the new one short */
+	current->preempt_pending = 0;
+
+	if (scheduler->preemptive)
+		arm_timer(current);
+}
+
+/* Add thread to ready queue */
+void mark_as_ready(thread_t *thread)
+{
+	unsigned long long ticks = thread->scheduler->stats.ticks;
+
+	if (thread->state == WAITING)
+		thread->ticks_waiting += ticks - thread->stamp;
+	thread->stamp = ticks;
+	if (thread->scheduler->latency)
+		thread->ready_ns = mono_ns();
+
+	thread->state = READY;
+	bqueue_push(thread->scheduler->ready, &thread->node, thread->priority);
+
+	SO_PROBE(ready, thread->scheduler, thread);
+
+	/* Wake-ups are not traced, keep the recorded state right */
+	if (thread->scheduler->flight)
+		flight_update(thread);
+}
+
+so_sched_t *so_create(unsigned int time_quantum, unsigned int io)
+{
+	scheduler_t *scheduler;
+
+	if (io > SO_MAX_NUM_EVENTS || !time_quantum)
+		return NULL;
+
+	DIE(!(scheduler = calloc(1, sizeof(scheduler_t))), "scheduler calloc!");
+	DIE(sem_init(&scheduler->end, 0, 0), "sem_init failed!");
+
+	scheduler->time_quantum = time_quantum;
+	scheduler->checkpoint_interval = SO_CHECKPOINT_INTERVAL;
+	scheduler->io = io;
+	scheduler->ready = bqueue_init(SO_MAX_PRIO + 1);
+	list_init(&scheduler->finished, NULL);
+
+	scheduler->tasks = table_init(free_func);
+	mpsc_init(&scheduler->inbox);
+	atomic_init(&scheduler->dump_fd, -1);
+	scheduler->trace_fd = -1;
+	atomic_init(&scheduler->stats_req, NULL);
+	DIE(pthread_mutex_init(&scheduler->stats_lock, NULL), "pthread_mutex_init failed!");
+	DIE((scheduler->idle_fd = eventfd(0, EFD_CLOEXEC)) < 0, "eventfd failed!");
+
+	scheduler->waiting = calloc(io, sizeof(LinkedList));
+	DIE(io && !scheduler->waiting, "Failed to calloc array of waiting queues!");
+
+	for (int i = 0; i != (int)io; ++i)
+		list_init(&scheduler->waiting[i], NULL);
+
+	return scheduler;
+}
+
+so_sched_t *so_create_ns(unsigned long long quantum_ns, unsigned int io)
+{
+	scheduler_t *scheduler;
+
+	if (!quantum_ns)
+		return NULL;
+
+	scheduler = so_create(1, io);
+	if (!scheduler)
+		return NULL;
+
+	scheduler->quantum_ns = quantum_ns;
+	return scheduler;
+}
+
+int so_init(unsigned int time_quantum, unsigned int io)
+{
+	if (default_scheduler)
+		return SO_FAIL;
+
+	default_scheduler = so_create(time_quantum, io);
+	return default_scheduler ? 0 : SO_FAIL;
+}
+
+int so_init_ns(unsigned long long quantum_ns, unsigned int io)
+{
+	if (default_scheduler)
+		return SO_FAIL;
+
+	default_scheduler = so_create_ns(quantum_ns, io);
+	return default_scheduler ? 0 : SO_FAIL;
+}
+
+int so_init_preemptive(unsigned long long quantum_ns, unsigned int io)
+{
+	struct sigaction action = { 0 };
+
+	if (so_init_ns(quantum_ns, io))
+		return SO_FAIL;
+
+	action.sa_handler = preempt_handler;
+	action.sa_flags = SA_RESTART;
+	DIE(sigemptyset(&action.sa_mask), "sigemptyset failed!");
+	DIE(sigaction(PREEMPT_SIGNAL, &action, &default_scheduler->old_action),
+	    "sigaction failed!");
+
+	default_scheduler->preemptive = 1;
+	return 0;
+}
+
+/* Creates the CPU timer of the calling thread, signaling only this thread */
+void create_timer(thread_t *thread)
+{
+	struct sigevent sev = { 0 };
+
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = PREEMPT_SIGNAL;
+	sev.sigev_notify_thread_id = gettid();
+	DIE(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &thread->timer), "timer_create failed!");
+}
+
+void *start_thread(void *args)
+{
+	thread_t *thread = args;
+	scheduler_t *scheduler = thread->scheduler;
+
+	current_thread = thread;
+	so_checkpoint_budget = scheduler->checkpoint_interval;
+
+	/* Shows up in top, perf and gdb, a failure only costs the name */
+	pthread_setname_np(pthread_self(), thread->name);
+
+	/* The thread should block here and wait until has the right to execute */
+	wait_turn(&thread->running);
+	latency_resumed(thread);
+
+	if (scheduler->preemptive) {
+		create_timer(thread);
+		arm_timer(thread);
+	}
+
+	/* Thread runs its tasks via handler, unless cancelled before its first run */
+	if (!thread->cancelled) {
+		if (thread->handler_arg)
+			thread->handler_arg(thread->arg, thread->priority);
+		else
+			thread->handler(thread->priority);
+	}
+
+	task_exit(thread);
+	return NULL;
+}
+
+/* Runs the exit callbacks and leaves the processor for good */
+void task_exit(thread_t *thread)
+{
+	scheduler_t *scheduler = thread->scheduler;
+	Node *node;
+	exit_cb_t *exit_cb;
+	size_t len;
+	char *dump;
+	int fd;
+
+	/* The thread never leaves the library from here on */
+	preempt_enter();
+	thread->exiting = 1;
+
+	/* Last registered, first called. The thread is still RUNNING here */
+	while ((node = remove_node(&thread->exit_cbs, 0))) {
+		exit_cb = node->data;
+		free(node);
+		exit_cb->cb(exit_cb->arg);
+		free(exit_cb);
+	}
+
+	/* Thread finished its tasks. Mark the thread as terminated */
+	thread->cpu_ns = thread_cpu_ns();
+	thread->state = TERMINATED;
+	--scheduler->alive;
+	TRACE(scheduler, TRACE_EXIT, thread, 0);
+	SO_PROBE(exit, scheduler, thread);
+	if (scheduler->preemptive)
+		DIE(timer_delete(thread->timer), "timer_delete failed!");
+	if (thread->joiner) {
+		thread->joiner->join_target = NULL;
+		mark_as_ready(thread->joiner);
+	}
+	if (thread->join_target)
+		thread->join_target->joiner = NULL;
+
+	/* Written before the handoff, so_end could return right after it */
+	serve_stats(scheduler);
+	dump = take_dump(scheduler, &len, &fd);
+	if (dump)
+		write_dump(fd, dump, len);
+
+	/* Call the scheduler */
+	scheduler_check(scheduler);
+
+	pthread_exit(NULL);
+}
+
+/* Creates a thread blocked in start_thread, not yet in the ready queue */
+thread_t *create_thread(scheduler_t *scheduler, so_handler *func, so_handler_arg *func_arg,
+			void *arg, unsigned int priority, const char *name)
+{
+	thread_t *thread;
+
+	DIE(!(thread = calloc(1, sizeof(thread_t))), "thread calloc failed!");
+	/* Init and start thread */
+	thread->scheduler = scheduler;
+	thread->priority = priority;
+	refill_quantum(thread);
+	thread->handler = func;
+	thread->handler_arg = func_arg;
+	thread->arg = arg;
+	thread->node.data = thread;
+	thread->sibling.data = thread;
+	thread->parent = scheduler->thread;
+	thread->cancelled = thread->parent && thread->parent->cancelled;
+	list_init(&thread->children, NULL);
+	if (thread->parent)
+		link_node(&thread->parent->children, &thread->sibling);
+	list_init(&thread->exit_cbs, free);
+
+	/* Named before the pthread starts, it names itself in start_thread */
+	thread->seq = ++scheduler->no_threads;
+	if (name)
+		snprintf(thread->name, sizeof(thread->name), "%s", name);
+	else
+		snprintf(thread->name, sizeof(thread->name), "so-p%u-%u", priority, thread->seq);
+
+	DIE(sem_init(&thread->running, 0, 0), "pthread_init failed!");
+	DIE(pthread_create(&thread->tid, NULL, start_thread, thread), "pthread_create failed!");
+
+	++scheduler->stats.forks;
+	++scheduler->alive;
+	TRACE(scheduler, TRACE_FORK, thread, thread->parent ? thread->parent->seq : 0);
+	if (scheduler->trace)
+		trace_name(scheduler->trace, thread->seq, thread->name);
+	SO_PROBE(fork, scheduler, thread);
+	table_insert(scheduler->tasks, thread->tid, thread);
+
+	return thread;
+}
+
+/* Scheduler of the calling thread, the default one outside the tasks */
+scheduler_t *caller_scheduler(void)
+{
+	return current_thread ? current_thread->scheduler : default_scheduler;
+}
+
+/*
+ * Only the running thread of a scheduler can fork on it, any other thread
+ * is limited to the first fork, the one starting the scheduler
+ */
+int can_fork(scheduler_t *scheduler)
+{
+	if (!scheduler)
+		return 0;
+
+	return scheduler->thread ? current_thread == scheduler->thread : 1;
+}
+
+/* Checks if the caller is the running thread of the scheduler */
+int is_running(scheduler_t *scheduler)
+{
+	return current_thread && current_thread == scheduler->thread;
+}
+
+/* Scheduling point at the end of a fork */
+void fork_check(scheduler_t *scheduler)
+{
+	if (scheduler->thread != NULL)
+		so_exec(); /* If fork was called by another thread */
+	else
+		scheduler_check(scheduler); /* If we are the first thread */
+}
+
+/* Common part of the forks with a scheduling point, one of func and func_arg is set */
+tid_t fork_on(scheduler_t *scheduler, so_handler *func, so_handler_arg *func_arg, void *arg,
+	      unsigned int priority, const char *name)
+{
+	PREEMPT_GUARD();
+	thread_t *thread;
+	tid_t tid;
+
+	if ((!func && !func_arg) || priority > SO_MAX_PRIO || !can_fork(scheduler))
+		return INVALID_TID;
+
+	thread = create_thread(scheduler, func, func_arg, arg, priority, name);
+	mark_as_ready(thread);
+
+	/* The child might be reaped before so_exec returns, keep its tid */
+	tid = thread->tid;
+	fork_check(scheduler);
+
+	return tid;
+}
+
+tid_t so_fork_on(so_sched_t *scheduler, so_handler *func, unsigned int priority)
+{
+	return func ? fork_on(scheduler, func, NULL, NULL, priority, NULL) : INVALID_TID;
+}
+
+tid_t so_fork_arg_on(so_sched_t *scheduler, so_handler_arg *func, void *arg,
+		     unsigned int priority)
+{
+	return func ? fork_on(scheduler, NULL, func, arg, priority, NULL) : INVALID_TID;
+}
+
+tid_t so_fork_named(so_handler *func, unsigned int priority, const char *name)
+{
+	return func ? fork_on(caller_scheduler(), func, NULL, NULL, priority, name) : INVALID_TID;
+}
+
+tid_t so_fork(so_handler *func, unsigned int priority)
+{
+	return so_fork_on(caller_scheduler(), func, priority);
+}
+
+tid_t so_fork_arg(so_handler_arg *func, void *arg, unsigned int priority)
+{
+	return so_fork_arg_on(caller_scheduler(), func, arg, priority);
+}
+
+tid_t so_spawn(so_handler *func, unsigned int priority)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread;
+
+	if (!func || priority > SO_MAX_PRIO || !can_fork(scheduler))
+		return INVALID_TID;
+
+	thread = create_thread(scheduler, func, NULL, NULL, priority, NULL);
+	mark_as_ready(thread);
+
+	/* No scheduling point, the child waits for the next one of the caller */
+	if (scheduler->thread == NULL)
+		scheduler_check(scheduler); /* Unless nothing runs yet */
+
+	return thread->tid;
+}
+
+int so_fork_many(so_handler_arg **funcs, void **args, unsigned int *priorities,
+		 unsigned int n, tid_t *tids)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t **threads;
+
+	if (!funcs || !priorities || !n || !can_fork(scheduler))
+		return SO_FAIL;
+
+	/* All or nothing, check every task before creating any */
+	for (unsigned int i = 0; i != n; ++i)
+		if (!funcs[i] || priorities[i] > SO_MAX_PRIO)
+			return SO_FAIL;
+
+	DIE(!(threads = malloc(n * sizeof(thread_t *))), "threads malloc failed!");
+	for (unsigned int i = 0; i != n; ++i)
+		threads[i] = create_thread(scheduler, NULL, funcs[i],
+					   args ? args[i] : NULL, priorities[i], NULL);
+
+	/* Bulk insert, then a single scheduling decision for the whole batch */
+	for (unsigned int i = 0; i != n; ++i) {
+		mark_as_ready(threads[i]);
+		if (tids)
+			tids[i] = threads[i]->tid;
+	}
+	free(threads);
+
+	fork_check(scheduler);
+
+	return n;
+}
+
+int so_wait(unsigned int io)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+
+	if (!scheduler || (int)io >= scheduler->io)
+		return SO_FAIL;
+
+	cancel_point(scheduler);
+
+	/* Wait for the received signal */
+	scheduler->thread->state = WAITING;
+	scheduler->thread->wait_list = &scheduler->waiting[io];
+	link_node(&scheduler->waiting[io], &scheduler->thread->node);
+	scheduler->thread->stamp = scheduler->stats.ticks;
+	++scheduler->stats.waits;
+	TRACE(scheduler, TRACE_WAIT, scheduler->thread, io);
+	SO_PROBE_IO(wait, scheduler, scheduler->thread, io);
+
+	so_exec();
+	return 0;
+}
+
+int so_signal(unsigned int io)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	int cnt;
+
+	if (!scheduler || (int)io >= scheduler->io)
+		return SO_FAIL;
+
+	cancel_point(scheduler);
+
+	/* Wake-up all the threads waiting for that specific io */
+	TRACE(scheduler, TRACE_SIGNAL, scheduler->thread, io);
+	SO_PROBE_IO(signal, scheduler, scheduler->thread, io);
+	cnt = wake_io(scheduler, io, scheduler->latency ? mono_ns() : 0);
+
+	so_exec();
+	return cnt;
+}
+
+int so_signal_external_on(so_sched_t *scheduler, unsigned int io)
+{
+	ext_signal_t *signal;
+
+	if (!scheduler || (int)io >= scheduler->io)
+		return SO_FAIL;
+
+	/* The running thread delivers it, producers never touch the queues */
+	DIE(!(signal = malloc(sizeof(ext_signal_t))), "signal malloc failed!");
+	signal->io = io;
+	signal->sent_ns = mono_ns();
+	mpsc_push(&scheduler->inbox, &signal->node);
+	wake_idle(scheduler);
+
+	return 0;
+}
+
+int so_signal_external(unsigned int io)
+{
+	return so_signal_external_on(caller_scheduler(), io);
+}
+
+/* Names the tasks forked before the tracing started */
+void trace_names(scheduler_t *scheduler)
+{
+	thread_t *thread;
+
+	for (int i = 0; i != table_size(scheduler->tasks); ++i) {
+		thread = table_get(scheduler->tasks, i);
+		trace_name(scheduler->trace, thread->seq, thread->name);
+	}
+}
+
+int so_trace_start(so_sched_t *scheduler, unsigned int records)
+{
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || scheduler->trace || !records)
+		return SO_FAIL;
+
+	scheduler->trace = trace_init(records);
+	trace_names(scheduler);
+	return 0;
+}
+
+int so_trace_write(so_sched_t *scheduler, int fd)
+{
+	uint32_t names;
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || !scheduler->trace)
+		return SO_FAIL;
+
+	/* Forks may grow the names meanwhile, other threads skip them until the end */
+	names = scheduler->trace->nnames;
+	if (scheduler->thread && current_thread != scheduler->thread &&
+	    !atomic_load(&scheduler->ended))
+		names = 0;
+
+	return trace_write(scheduler->trace, fd, names);
+}
+
+int so_trace_on_end(so_sched_t *scheduler, int fd)
+{
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || !scheduler->trace || fd < 0)
+		return SO_FAIL;
+
+	scheduler->trace_fd = fd;
+	return 0;
+}
+
+int so_flight_record(so_sched_t *scheduler, const char *path, unsigned int records,
+		     unsigned int tasks)
+{
+	thread_t *thread;
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || !path || scheduler->trace || !records || !tasks)
+		return SO_FAIL;
+
+	scheduler->flight = flight_open(path, records, tasks);
+	if (!scheduler->flight)
+		return SO_FAIL;
+	scheduler->trace = scheduler->flight->ring;
+	trace_names(scheduler);
+
+	/* Slots of the threads forked so far */
+	for (int i = 0; i != table_size(scheduler->tasks); ++i) {
+		thread = table_get(scheduler->tasks, i);
+		flight_update(thread);
+	}
+
+	return 0;
+}
+
+/* Copies counters written by another thread, each of them as a whole */
+void load_counters(unsigned long long *dst, unsigned long long *src, int n)
+{
+	for (int i = 0; i != n; ++i)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+int so_get_stats(so_sched_t *scheduler, so_stats_t *stats, so_task_stats_t *tasks,
+		 unsigned int n)
+{
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler)
+		return SO_FAIL;
+
+	/* so_stats_t only holds counters */
+	if (stats)
+		load_counters((unsigned long long *)stats, (unsigned long long *)&scheduler->stats,
+			      sizeof(so_stats_t) / sizeof(unsigned long long));
+
+	if (!tasks || !n)
+		return table_size(scheduler->tasks);
+
+	/* Forks may grow the task table, only the running thread walks it, others ask it */
+	if (scheduler->thread && current_thread != scheduler->thread &&
+	    !atomic_load(&scheduler->ended))
+		return request_stats(scheduler, tasks, n);
+
+	return copy_task_stats(scheduler, tasks, n);
+}
+
+int so_latency_start(so_sched_t *scheduler)
+{
+	histogram_t *latency;
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || scheduler->latency)
+		return SO_FAIL;
+
+	DIE(!(latency = malloc(SO_LATENCY_KINDS * sizeof(histogram_t))), "latency malloc failed!");
+	for (int i = 0; i != SO_LATENCY_KINDS; ++i)
+		hist_init(&latency[i]);
+	scheduler->latency = latency;
+
+	return 0;
+}
+
+int so_get_latency(so_sched_t *scheduler, unsigned int kind, so_latency_t *lat)
+{
+	histogram_t *hist;
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || !scheduler->latency || kind >= SO_LATENCY_KINDS || !lat)
+		return SO_FAIL;
+
+	hist = &scheduler->latency[kind];
+	lat->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	lat->min = lat->count ? __atomic_load_n(&hist->min, __ATOMIC_RELAXED) : 0;
+	lat->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	lat->mean = lat->count ? __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / lat->count : 0;
+	lat->p50 = hist_percentile(hist, 50);
+	lat->p90 = hist_percentile(hist, 90);
+	lat->p99 = hist_percentile(hist, 99);
+	lat->p999 = hist_percentile(hist, 99.9);
+
+	return 0;
+}
+
+int so_dump_state(so_sched_t *scheduler, int fd)
+{
+	PREEMPT_GUARD();
+	size_t len;
+	char *dump;
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || fd < 0)
+		return SO_FAIL;
+
+	/* Only the running thread sees a consistent state, others ask it */
+	if (scheduler->thread && current_thread != scheduler->thread) {
+		request_dump(scheduler, fd);
+		return 0;
+	}
+
+	dump = snapshot(scheduler, &len);
+	write_dump(fd, dump, len);
+	return 0;
+}
+
+int so_dump_on_signal(so_sched_t *scheduler, int fd)
+{
+	struct sigaction action = { 0 };
+
+	if (!scheduler)
+		scheduler = caller_scheduler();
+
+	if (!scheduler || fd < 0 || dump_signal_sched)
+		return SO_FAIL;
+
+	dump_signal_fd = fd;
+	dump_signal_sched = scheduler;
+
+	action.sa_handler = dump_handler;
+	action.sa_flags = SA_RESTART;
+	DIE(sigemptyset(&action.sa_mask), "sigemptyset failed!");
+	DIE(sigaction(SIGUSR2, &action, &dump_old_action), "sigaction failed!");
+
+	return 0;
+}
+
+int so_attach_source_on(so_sched_t *scheduler)
+{
+	if (!scheduler)
+		return SO_FAIL;
+
+	atomic_fetch_add(&scheduler->sources, 1);
+	return 0;
+}
+
+int so_detach_source_on(so_sched_t *scheduler)
+{
+	if (!scheduler || atomic_load(&scheduler->sources) <= 0)
+		return SO_FAIL;
+
+	/* An idle scheduler has to check again if it can still be woken */
+	atomic_fetch_sub(&scheduler->sources, 1);
+	wake_idle(scheduler);
+	return 0;
+}
+
+int so_attach_source(void)
+{
+	return so_attach_source_on(caller_scheduler());
+}
+
+int so_detach_source(void)
+{
+	return so_detach_source_on(caller_scheduler());
+}
+
+int so_setprio(tid_t tid, unsigned int priority)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread;
+
+	/* The ready queue is only touched by the running thread */
+	if (!scheduler || priority > SO_MAX_PRIO || !is_running(scheduler))
+		return SO_FAIL;
+
+	thread = find_thread(scheduler, tid);
+	if (!thread || thread->state == TERMINATED)
+		return SO_FAIL;
+
+	if (thread->state == READY) {
+		/* Move the thread between ready buckets through its node */
+		bqueue_remove(scheduler->ready, &thread->node, thread->priority);
+		thread->priority = priority;
+		bqueue_push(scheduler->ready, &thread->node, thread->priority);
+	} else {
+		/* Waiting lists are FIFO, so the thread keeps its place there */
+		thread->priority = priority;
+	}
+
+	/* Preempt the caller only if it no longer has the highest priority */
+	if (bqueue_top_prio(scheduler->ready) > current_thread->priority)
+		reschedule(scheduler, 0);
+
+	return 0;
+}
+
+int so_join(tid_t tid)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread;
+
+	/* Only the running thread can be parked, any other would run alongside it */
+	if (!scheduler || !is_running(scheduler))
+		return SO_FAIL;
+
+	thread = find_thread(scheduler, tid);
+	if (!thread || thread == scheduler->thread || thread->joiner)
+		return SO_FAIL;
+
+	/* Park the caller, the target wakes it up when it terminates */
+	if (thread->state != TERMINATED) {
+		thread->joiner = scheduler->thread;
+		scheduler->thread->join_target = thread;
+		scheduler->thread->state = WAITING;
+		scheduler->thread->stamp = scheduler->stats.ticks;
+		TRACE(scheduler, TRACE_JOIN, scheduler->thread, thread->seq);
+		so_exec();
+	}
+
+	reap_thread(thread);
+	return 0;
+}
+
+int so_on_exit(tid_t tid, so_exit_cb *cb, void *arg)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread;
+	exit_cb_t *exit_cb;
+
+	if (!scheduler || !cb || !is_running(scheduler))
+		return SO_FAIL;
+
+	thread = find_thread(scheduler, tid);
+	if (!thread || thread->state == TERMINATED)
+		return SO_FAIL;
+
+	DIE(!(exit_cb = malloc(sizeof(exit_cb_t))), "exit_cb malloc failed!");
+	exit_cb->cb = cb;
+	exit_cb->arg = arg;
+	add_node(&thread->exit_cbs, 0, exit_cb);
+
+	return 0;
+}
+
+int so_cancel(tid_t tid)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread, *it;
+
+	if (!scheduler || !is_running(scheduler))
+		return SO_FAIL;
+
+	thread = find_thread(scheduler, tid);
+	if (!thread || thread->state == TERMINATED)
+		return SO_FAIL;
+
+	/* Cancel the thread and every live thread it forked, directly or not */
+	for (int i = 0; i != table_size(scheduler->tasks); ++i) {
+		it = table_get(scheduler->tasks, i);
+		if (it->state != TERMINATED && !it->cancelled && descends_from(it, thread))
+			cancel_thread(it);
+	}
+
+	return 0;
+}
+
+int so_getprio(tid_t tid)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread;
+
+	/* The task table may be growing under any other thread */
+	if (!scheduler || !is_running(scheduler))
+		return SO_FAIL;
+
+	thread = find_thread(scheduler, tid);
+	if (!thread)
+		return SO_FAIL;
+
+	return thread->priority;
+}
+
+void so_exec(void)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+
+	cancel_point(scheduler);
+
+	/* Call the scheduler */
+	reschedule(scheduler, 1);
+
+	/* The thread might have been cancelled while it was preempted */
+	cancel_point(scheduler);
+}
+
+void so_exec_n(unsigned int units)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *current;
+	unsigned int step;
+
+	/* A CPU time quantum is charged by the clock, not by the units */
+	if (scheduler->quantum_ns && units)
+		units = 1;
+
+	while (units) {
+		cancel_point(scheduler);
+		current = scheduler->thread;
+
+		/*
+		 * Nothing else runs between two so_exec calls, so the only decisions
+		 * left are a priority preemption after the first tick or a switch
+		 * when the quantum runs out. Charge up to the next one at once.
+		 */
+		if (current->priority < bqueue_top_prio(scheduler->ready))
+			step = 1;
+		else
+			step = units < (unsigned int)current->time_quantum ?
+				units : (unsigned int)current->time_quantum;
+
+		units -= step;
+		reschedule(scheduler, step);
+	}
+
+	cancel_point(scheduler);
+}
+
+void so_yield(void)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *current = scheduler->thread;
+
+	cancel_point(scheduler);
+
+	/* Nobody to hand the processor to, keep running without a switch */
+	if (current->priority > bqueue_top_prio(scheduler->ready))
+		return;
+
+	/* Forfeit the quantum, the scheduler puts the thread behind its peers */
+	current->time_quantum = 0;
+	reschedule(scheduler, 0);
+
+	cancel_point(scheduler);
+}
+
+int so_set_checkpoint_interval(long interval)
+{
+	scheduler_t *scheduler = caller_scheduler();
+
+	if (!scheduler || interval <= 0)
+		return SO_FAIL;
+
+	scheduler->checkpoint_interval = interval;
+	return 0;
+}
+
+void so_checkpoint_slow(void)
+{
+	PREEMPT_GUARD();
+	scheduler_t *scheduler = caller_scheduler();
+	thread_t *thread = current_thread;
+
+	/* Not a scheduled thread, never look again */
+	if (!thread || !scheduler || thread != scheduler->thread) {
+		so_checkpoint_budget = LONG_MAX;
+		return;
+	}
+
+	so_checkpoint_budget = scheduler->checkpoint_interval;
+
+	/* A CPU time quantum is only worth a scheduling point once it is spent */
+	if (scheduler->quantum_ns) {
+		charge(thread, 0);
+		if (thread->time_quantum)
+			return;
+	}
+
+	so_exec();
+}
+
+void so_preempt_disable(void)
+{
+	preempt_enter();
+}
+
+void so_preempt_enable(void)
+{
+	preempt_leave(NULL);
+}
+
+void so_destroy(so_sched_t *scheduler)
+{
+	mpsc_node_t *node;
+
+	if (!scheduler)
+		return;
+
+	/* Wait for all threads to finish */
+	if (scheduler->no_threads)
+		wait_turn(&scheduler->end);
+
+	if (scheduler->preemptive)
+		DIE(sigaction(PREEMPT_SIGNAL, &scheduler->old_action, NULL), "sigaction failed!");
+	if (scheduler == dump_signal_sched) {
+		DIE(sigaction(SIGUSR2, &dump_old_action, NULL), "sigaction failed!");
+		dump_signal_sched = NULL;
+	}
+
+	/* Every event is in, errors are dropped like those of the dumps */
+	if (scheduler->trace && scheduler->trace_fd >= 0)
+		trace_write(scheduler->trace, scheduler->trace_fd, scheduler->trace->nnames);
+
+	/* The task table owns every thread, the queues only link them */
+	table_free(scheduler->tasks);
+	bqueue_free(scheduler->ready);
+	trace_free(scheduler->trace);
+	free(scheduler->latency);
+	flight_close(scheduler->flight);
+
+	/* Signals posted after the last scheduling point */
+	while ((node = mpsc_pop(&scheduler->inbox)))
+		free(node);
+
+	DIE(sem_destroy(&scheduler->end), "sem_destroy failed!");
+	DIE(pthread_mutex_destroy(&scheduler->stats_lock), "pthread_mutex_destroy failed!");
+	DIE(close(scheduler->idle_fd), "close failed!");
+	free(scheduler->waiting);
+
+	if (scheduler == default_scheduler)
+		default_scheduler = NULL;
+	free(scheduler);
+}
+
+void so_end(void)
+{
+	so_destroy(default_scheduler);
 }
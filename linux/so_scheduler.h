@@ -42,6 +42,16 @@ typedef DWORD tid_t;
  */
 #define INVALID_TID ((tid_t)0)
 
+/*
+ * max length of a task name, NUL included
+ */
+#define SO_TASK_NAME_LEN 16
+
+/*
+ * default number of SO_CHECKPOINT calls worth one so_exec
+ */
+#define SO_CHECKPOINT_INTERVAL 1024
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -51,6 +61,75 @@ extern "C" {
  */
 typedef void (so_handler)(unsigned int);
 
+/*
+ * handler prototype with a user argument
+ */
+typedef void (so_handler_arg)(void *, unsigned int);
+
+/*
+ * exit callback prototype
+ */
+typedef void (so_exit_cb)(void *);
+
+/*
+ * scheduler instance, see so_create
+ */
+typedef struct so_sched so_sched_t;
+
+/*
+ * scheduler counters, see so_get_stats
+ */
+typedef struct {
+	unsigned long long forks;
+	unsigned long long switches; /* dispatches of another task */
+	unsigned long long preempt_prio; /* a more important task became ready */
+	unsigned long long preempt_quantum; /* the time quantum expired */
+	unsigned long long waits;
+	unsigned long long signals; /* so_signal calls and external signals */
+	unsigned long long wakeups; /* tasks woken by signals */
+	unsigned long long idles; /* sleeps with every task waiting */
+	unsigned long long ticks; /* units charged to the tasks */
+} so_stats_t;
+
+/*
+ * per-task counters, see so_get_stats
+ */
+typedef struct {
+	tid_t tid;
+	unsigned int seq; /* 1 for the first fork of the scheduler */
+	char name[SO_TASK_NAME_LEN]; /* see so_fork_named */
+	unsigned int priority;
+	unsigned long long ticks_run; /* units charged to the task */
+	unsigned long long ticks_ready; /* scheduler ticks in the ready queue */
+	unsigned long long ticks_waiting; /* scheduler ticks in so_wait/so_join */
+	unsigned long long dispatches;
+	unsigned long long cpu_ns; /* CPU time, kept up to date in ns mode only */
+} so_task_stats_t;
+
+/*
+ * latencies measured by so_latency_start, in ns
+ */
+enum {
+	SO_LATENCY_DISPATCH, /* handoff in the scheduler until the task runs */
+	SO_LATENCY_READY, /* time spent in the ready queue */
+	SO_LATENCY_SIGNAL, /* so_signal until a woken task runs */
+	SO_LATENCY_KINDS
+};
+
+/*
+ * summary of a latency histogram, see so_get_latency
+ */
+typedef struct {
+	unsigned long long count;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long mean;
+	unsigned long long p50;
+	unsigned long long p90;
+	unsigned long long p99;
+	unsigned long long p999;
+} so_latency_t;
+
 /*
  * creates and initializes scheduler
  * + time quantum for each thread
@@ -59,6 +138,44 @@ typedef void (so_handler)(unsigned int);
  */
 DECL_PREFIX int so_init(unsigned int time_quantum, unsigned int io);
 
+/*
+ * same as so_init, but the time quantum is CPU time measured at every
+ * scheduling point instead of a number of so_exec calls
+ * + time quantum in nanoseconds
+ * + number of IO devices supported
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_init_ns(unsigned long long quantum_ns, unsigned int io);
+
+/*
+ * same as so_init_ns, but a per-task CPU timer raising SIGRTMIN + 1
+ * on the task marks its quantum as expired; the task is then preempted
+ * at its next SO_CHECKPOINT or at the end of its next so_* call, never
+ * from the signal handler, so it may use stdio, malloc and other locks
+ * + time quantum in nanoseconds
+ * + number of IO devices supported
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_init_preemptive(unsigned long long quantum_ns, unsigned int io);
+
+/*
+ * creates a scheduler instance independent of the one set up by so_init;
+ * its tasks run alongside the tasks of any other instance and the so_*
+ * calls made by a task act on the instance owning it
+ * + time quantum for each thread
+ * + number of IO devices supported
+ * returns: the new instance or NULL on error
+ */
+DECL_PREFIX so_sched_t *so_create(unsigned int time_quantum, unsigned int io);
+
+/*
+ * same as so_create, with a CPU time quantum as in so_init_ns
+ * + time quantum in nanoseconds
+ * + number of IO devices supported
+ * returns: the new instance or NULL on error
+ */
+DECL_PREFIX so_sched_t *so_create_ns(unsigned long long quantum_ns, unsigned int io);
+
 /*
  * creates a new so_task_t and runs it according to the scheduler
  * + handler function
@@ -67,6 +184,70 @@ DECL_PREFIX int so_init(unsigned int time_quantum, unsigned int io);
  */
 DECL_PREFIX tid_t so_fork(so_handler *func, unsigned int priority);
 
+/*
+ * same as so_fork, but the handler also receives a user argument
+ * + handler function
+ * + argument passed to the handler
+ * + priority
+ * returns: tid of the new task if successful or INVALID_TID
+ */
+DECL_PREFIX tid_t so_fork_arg(so_handler_arg *func, void *arg, unsigned int priority);
+
+/*
+ * same as so_fork, but without a scheduling point: the caller keeps
+ * running and does not consume time; the new task can only preempt it
+ * at its next so_* call
+ * + handler function
+ * + priority
+ * returns: tid of the new task if successful or INVALID_TID
+ */
+DECL_PREFIX tid_t so_spawn(so_handler *func, unsigned int priority);
+
+/*
+ * same as so_fork, but names the thread of the task (pthread_setname_np)
+ * so that top, perf or gdb show it; tasks forked otherwise are named
+ * so-p<priority>-<sequence id>; the name is also in the trace, the
+ * flight recorder, the stats and the dumps
+ * + handler function
+ * + priority
+ * + name, truncated to SO_TASK_NAME_LEN - 1 characters
+ * returns: tid of the new task if successful or INVALID_TID
+ */
+DECL_PREFIX tid_t so_fork_named(so_handler *func, unsigned int priority, const char *name);
+
+/*
+ * same as so_fork, on a given instance; outside its tasks, only the
+ * first fork, which starts the instance, is allowed
+ * + scheduler instance
+ * + handler function
+ * + priority
+ * returns: tid of the new task if successful or INVALID_TID
+ */
+DECL_PREFIX tid_t so_fork_on(so_sched_t *sched, so_handler *func, unsigned int priority);
+
+/*
+ * same as so_fork_arg, on a given instance, see so_fork_on
+ * + scheduler instance
+ * + handler function
+ * + argument passed to the handler
+ * + priority
+ * returns: tid of the new task if successful or INVALID_TID
+ */
+DECL_PREFIX tid_t so_fork_arg_on(so_sched_t *sched, so_handler_arg *func, void *arg,
+				 unsigned int priority);
+
+/*
+ * creates n tasks at once with a single scheduling decision
+ * + handler functions
+ * + arguments passed to the handlers, may be NULL
+ * + priorities
+ * + number of tasks
+ * + array filled with the tids of the new tasks, may be NULL
+ * returns: n on success or -1 on error, in which case no task is created
+ */
+DECL_PREFIX int so_fork_many(so_handler_arg **funcs, void **args,
+			     unsigned int *priorities, unsigned int n, tid_t *tids);
+
 /*
  * waits for an IO device
  * + device index
@@ -81,16 +262,269 @@ DECL_PREFIX int so_wait(unsigned int io);
  */
 DECL_PREFIX int so_signal(unsigned int io);
 
+/*
+ * signals an IO device from any thread, including threads outside the
+ * scheduler; the waiting tasks are woken at the next scheduling point
+ * + IO device
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_signal_external(unsigned int io);
+
+/*
+ * same as so_signal_external, on a given instance
+ * + scheduler instance
+ * + IO device
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_signal_external_on(so_sched_t *sched, unsigned int io);
+
+/*
+ * registers a source of so_signal_external calls; when every task waits,
+ * the scheduler sleeps until a source signals it, or reports a deadlock
+ * and exits with EDEADLK if no source is attached
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_attach_source(void);
+
+/*
+ * unregisters a source attached through so_attach_source
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_detach_source(void);
+
+/*
+ * same as so_attach_source, on a given instance
+ * + scheduler instance
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_attach_source_on(so_sched_t *sched);
+
+/*
+ * same as so_detach_source, on a given instance
+ * + scheduler instance
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_detach_source_on(so_sched_t *sched);
+
+/*
+ * starts recording every fork, dispatch, preemption, wait, signal and
+ * termination in a ring holding the most recent records
+ * + scheduler instance, NULL for the one of the caller
+ * + number of records kept, rounded up to a power of two
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_trace_start(so_sched_t *sched, unsigned int records);
+
+/*
+ * writes the recorded events and the names of every task forked while
+ * tracing in the binary format of linux/trace.h, convert it with
+ * tools/trace2json; outside the tasks of the instance, the events
+ * recorded meanwhile may be torn and the names are left out until the
+ * last task terminated
+ * + scheduler instance, NULL for the one of the caller
+ * + file descriptor
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_trace_write(so_sched_t *sched, int fd);
+
+/*
+ * writes the trace like so_trace_write once the last task terminated,
+ * when the instance is destroyed; write errors are dropped
+ * + scheduler instance, NULL for the one of the caller
+ * + file descriptor, kept open by the caller until then
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_trace_on_end(so_sched_t *sched, int fd);
+
+/*
+ * same as so_trace_start, but the ring and the last state of every task
+ * live in a shared mapping of a file, which keeps them after a crash;
+ * decode it with tools/flightdump
+ * + scheduler instance, NULL for the one of the caller
+ * + path of the file, created or truncated
+ * + number of records kept, rounded up to a power of two
+ * + number of task slots, rounded up to a power of two; task n uses
+ *   slot n modulo the number of slots
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_flight_record(so_sched_t *sched, const char *path, unsigned int records,
+				 unsigned int tasks);
+
+/*
+ * copies the counters of a scheduler; any thread can read them at any
+ * time; the per-task counters asked for outside the running task are
+ * copied by the next scheduling point, and the call waits for it
+ * + scheduler instance, NULL for the one of the caller
+ * + counters, can be NULL
+ * + per-task counters, can be NULL
+ * + size of the per-task array
+ * returns: number of tasks which were not reaped yet or negative on error
+ */
+DECL_PREFIX int so_get_stats(so_sched_t *sched, so_stats_t *stats, so_task_stats_t *tasks,
+			     unsigned int n);
+
+/*
+ * starts recording the SO_LATENCY_* latencies in log-linear histograms
+ * with a fixed size and a relative error under 1/16
+ * + scheduler instance, NULL for the one of the caller
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_latency_start(so_sched_t *sched);
+
+/*
+ * summarizes one of the latency histograms; any thread can call it at
+ * any time
+ * + scheduler instance, NULL for the one of the caller
+ * + SO_LATENCY_* kind
+ * + summary
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_get_latency(so_sched_t *sched, unsigned int kind, so_latency_t *lat);
+
+/*
+ * writes a text snapshot of the ready queue by priority, of every waiting
+ * queue, of the finished tasks and of every task; called outside the
+ * running task, the snapshot is copied at the next scheduling point and
+ * written once the next task got the processor
+ * + scheduler instance, NULL for the one of the caller
+ * + file descriptor
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_dump_state(so_sched_t *sched, int fd);
+
+/*
+ * makes SIGUSR2 call so_dump_state for an instance, from then on until
+ * the instance is destroyed
+ * + scheduler instance, NULL for the one of the caller
+ * + file descriptor
+ * returns: 0 on success or negative on error
+ */
+DECL_PREFIX int so_dump_on_signal(so_sched_t *sched, int fd);
+
+/*
+ * changes the priority of a task and preempts the caller
+ * if it no longer has the highest priority; only the running
+ * task can change priorities
+ * + task id
+ * + new priority
+ * returns: 0 on success or -1 on error
+ */
+DECL_PREFIX int so_setprio(tid_t tid, unsigned int priority);
+
+/*
+ * gets the priority of a task; only the running task can read it
+ * + task id
+ * returns: the priority or -1 on error
+ */
+DECL_PREFIX int so_getprio(tid_t tid);
+
+/*
+ * blocks the calling task until a task terminates and releases
+ * the resources of the terminated task; as with pthread_join, the
+ * task id may be returned again by a later fork, so it must not be
+ * passed to any so_* call once so_join returned; only the running
+ * task can join
+ * + task id
+ * returns: 0 on success or -1 on error
+ */
+DECL_PREFIX int so_join(tid_t tid);
+
+/*
+ * registers a callback called when a task terminates, last
+ * registered callback is called first; only the running task can
+ * register one
+ * + task id
+ * + callback
+ * + callback argument
+ * returns: 0 on success or -1 on error
+ */
+DECL_PREFIX int so_on_exit(tid_t tid, so_exit_cb *cb, void *arg);
+
+/*
+ * cancels a task and every task it forked; a cancelled task
+ * terminates the next time it calls so_exec, so_wait or so_signal,
+ * running its exit callbacks; only the running task can cancel
+ * + task id
+ * returns: 0 on success or -1 on error
+ */
+DECL_PREFIX int so_cancel(tid_t tid);
+
 /*
  * does whatever operation
  */
 DECL_PREFIX void so_exec(void);
 
+/*
+ * does whatever operation worth several so_exec calls, the resulting
+ * schedule is the same as calling so_exec units times; with so_init_ns
+ * it is the same as a single so_exec
+ * + number of so_exec calls accounted
+ */
+DECL_PREFIX void so_exec_n(unsigned int units);
+
+/*
+ * gives up the rest of the time quantum and moves the caller behind
+ * the tasks with the same priority; does nothing if there are none
+ */
+DECL_PREFIX void so_yield(void);
+
+/*
+ * starts a section of the calling task which is not preempted by the
+ * timer of so_init_preemptive; sections can be nested
+ */
+DECL_PREFIX void so_preempt_disable(void);
+
+/*
+ * ends a section started by so_preempt_disable, the task is preempted
+ * here if its quantum expired inside the section
+ */
+DECL_PREFIX void so_preempt_enable(void);
+
+/*
+ * sets how many SO_CHECKPOINT calls are worth one so_exec; with
+ * so_init_ns it is how often the CPU time quantum is checked
+ * + number of SO_CHECKPOINT calls
+ * returns: 0 on success or -1 on error
+ */
+DECL_PREFIX int so_set_checkpoint_interval(long interval);
+
+/*
+ * slow path of SO_CHECKPOINT, calls so_exec if the quantum of the task
+ * is spent
+ */
+DECL_PREFIX void so_checkpoint_slow(void);
+
+#ifdef __linux__
+/*
+ * SO_CHECKPOINT calls left before the calling task checks its quantum;
+ * volatile, as the preemption timer zeroes it from a signal handler
+ */
+extern __thread volatile long so_checkpoint_budget __attribute__((tls_model("initial-exec")));
+
+/*
+ * cheap preemption point, meant for loops and instrumented code; the
+ * library built with `make instrumented` also calls it on every function
+ * entry of code compiled with -finstrument-functions, and so does
+ * libso_instrument.a, which saves the PLT call when linked into the program
+ */
+#define SO_CHECKPOINT()							\
+	do {								\
+		if (__builtin_expect(--so_checkpoint_budget < 0, 0))	\
+			so_checkpoint_slow();				\
+	} while (0)
+#endif
+
 /*
  * destroys a scheduler
  */
 DECL_PREFIX void so_end(void);
 
+/*
+ * waits for the tasks of an instance to finish, then destroys it
+ * + scheduler instance
+ */
+DECL_PREFIX void so_destroy(so_sched_t *sched);
+
 #ifdef __cplusplus
 }
 #endif
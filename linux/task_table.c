@@ -0,0 +1,164 @@
+#include "task_table.h"
+
+/* Fibonacci hashing, pthread ids are aligned pointers so low bits are poor */
+static int table_hash(task_table_t *table, tid_t key)
+{
+	return (int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 32) & (table->slots - 1);
+}
+
+/* Slot holding key or the empty slot where it would be inserted */
+static int table_probe(task_table_t *table, tid_t key)
+{
+	int slot = table_hash(table, key);
+
+	while (table->keys[slot] != INVALID_TID && !pthread_equal(table->keys[slot], key))
+		slot = (slot + 1) & (table->slots - 1);
+
+	return slot;
+}
+
+static void table_alloc(task_table_t *table, int slots)
+{
+	table->slots = slots;
+	DIE(!(table->keys = calloc(slots, sizeof(tid_t))), "keys calloc failed!");
+	DIE(!(table->index = calloc(slots, sizeof(int))), "index calloc failed!");
+
+	/* The load factor is kept under 1/2, so the dense arrays need half the slots */
+	table->items = realloc(table->items, slots / 2 * sizeof(void *));
+	DIE(!table->items, "items realloc failed!");
+	table->item_keys = realloc(table->item_keys, slots / 2 * sizeof(tid_t));
+	DIE(!table->item_keys, "item_keys realloc failed!");
+}
+
+/* Double the number of slots and rehash the keys from the dense array */
+static void table_grow(task_table_t *table)
+{
+	int slot;
+
+	free(table->keys);
+	free(table->index);
+	table_alloc(table, table->slots * 2);
+
+	for (int i = 0; i != table->size; ++i) {
+		slot = table_probe(table, table->item_keys[i]);
+		table->keys[slot] = table->item_keys[i];
+		table->index[slot] = i;
+	}
+}
+
+task_table_t *table_init(void (*free_func)(void *))
+{
+	task_table_t *table = calloc(1, sizeof(task_table_t));
+
+	DIE(!table, "table calloc failed!");
+
+	DIE(!free_func, "NULL pointer to free_func not allowed!");
+	table->free_func = free_func;
+
+	table_alloc(table, TABLE_INIT_SLOTS);
+
+	return table;
+}
+
+void table_insert(task_table_t *table, tid_t key, void *val)
+{
+	int slot;
+
+	if (!table || key == INVALID_TID || !val)
+		return;
+
+	if (2 * (table->size + 1) > table->slots)
+		table_grow(table);
+
+	slot = table_probe(table, key);
+	if (table->keys[slot] != INVALID_TID) {
+		/* Key already present, replace the value */
+		table->items[table->index[slot]] = val;
+		return;
+	}
+
+	table->keys[slot] = key;
+	table->index[slot] = table->size;
+	table->items[table->size] = val;
+	table->item_keys[table->size] = key;
+	++table->size;
+}
+
+void *table_find(task_table_t *table, tid_t key)
+{
+	int slot;
+
+	if (!table || key == INVALID_TID)
+		return NULL;
+
+	slot = table_probe(table, key);
+	return table->keys[slot] == INVALID_TID ? NULL : table->items[table->index[slot]];
+}
+
+void *table_remove(task_table_t *table, tid_t key)
+{
+	int slot, next, home, last;
+	void *val;
+
+	if (!table || key == INVALID_TID)
+		return NULL;
+
+	slot = table_probe(table, key);
+	if (table->keys[slot] == INVALID_TID)
+		return NULL;
+
+	/* Move the last dense entry in the hole and fix its slot */
+	val = table->items[table->index[slot]];
+	last = --table->size;
+	if (table->index[slot] != last) {
+		table->items[table->index[slot]] = table->items[last];
+		table->item_keys[table->index[slot]] = table->item_keys[last];
+		table->index[table_probe(table, table->item_keys[last])] = table->index[slot];
+	}
+
+	/* Backward shift deletion, keeps probe chains intact without tombstones */
+	for (next = (slot + 1) & (table->slots - 1);
+	     table->keys[next] != INVALID_TID;
+	     next = (next + 1) & (table->slots - 1)) {
+		home = table_hash(table, table->keys[next]);
+		/* Skip entries whose home slot lies cyclically in (slot, next] */
+		if (((next - home) & (table->slots - 1)) < ((next - slot) & (table->slots - 1)))
+			continue;
+
+		table->keys[slot] = table->keys[next];
+		table->index[slot] = table->index[next];
+		slot = next;
+	}
+	table->keys[slot] = INVALID_TID;
+
+	return val;
+}
+
+/* Gets the nth live value, used for walking every entry */
+void *table_get(task_table_t *table, int nth)
+{
+	if (!table || nth < 0 || nth >= table->size)
+		return NULL;
+
+	return table->items[nth];
+}
+
+int table_size(task_table_t *table)
+{
+	return table ? table->size : -1;
+}
+
+void table_free(task_table_t *table)
+{
+	if (!table)
+		return;
+
+	for (int i = 0; i != table->size; ++i)
+		table->free_func(table->items[i]);
+
+	free(table->keys);
+	free(table->index);
+	free(table->items);
+	free(table->item_keys);
+	free(table);
+}
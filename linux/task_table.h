@@ -0,0 +1,50 @@
+/**
+ * Table mapping task ids to tasks in O(1).
+ * Keys live in an open addressing hash (linear probing, backward shift
+ * deletion) and the values are kept packed in a dense array, so walking
+ * every live task touches contiguous memory only. The keys are pthread
+ * ids, which the C library reuses once a thread is joined, so an entry
+ * is only valid until its task is reaped.
+ */
+
+#ifndef TASK_TABLE_H_
+#define TASK_TABLE_H_
+
+#include "so_scheduler.h"
+#include "utils.h"
+
+/* Initial number of hash slots, always a power of 2 */
+#define TABLE_INIT_SLOTS 64
+
+typedef struct task_table_t task_table_t;
+struct task_table_t {
+	/* Hash slots, INVALID_TID marks an empty slot */
+	tid_t *keys;
+	/* Index in the dense arrays for every used slot */
+	int *index;
+	/* Dense array of values and their keys */
+	void **items;
+	tid_t *item_keys;
+	/* Number of live entries */
+	int size;
+	/* Number of hash slots */
+	int slots;
+	/* Function used for freeing a custom element */
+	void (*free_func)(void *a);
+};
+
+task_table_t *table_init(void (*free_func)(void *));
+
+void table_insert(task_table_t *table, tid_t key, void *val);
+
+void *table_find(task_table_t *table, tid_t key);
+
+void *table_remove(task_table_t *table, tid_t key);
+
+void *table_get(task_table_t *table, int nth);
+
+int table_size(task_table_t *table);
+
+void table_free(task_table_t *table);
+
+#endif /* TASK_TABLE_H_ */
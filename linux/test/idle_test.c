@@ -0,0 +1,65 @@
+/**
+ * Idle test: a thread outside the scheduler signals a waiting task and
+ * detaches right away, racing with the scheduler going idle once the
+ * last running task exits. The signal must always be delivered, never
+ * reported as a deadlock.
+ */
+
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "test.h"
+#include "../so_scheduler.h"
+
+#define ROUNDS 2000
+
+static int woken;
+static atomic_int parked, detached;
+
+static void waiter(unsigned int prio)
+{
+	(void)prio;
+	CHECK(so_wait(0) == 0);
+	++woken;
+
+	/* The scheduler, and its sources, end with the last task */
+	while (!atomic_load(&detached))
+		sched_yield();
+}
+
+/* The waiter preempts it and parks before it sets the flag and exits */
+static void root(unsigned int prio)
+{
+	CHECK(so_fork(waiter, prio + 1) != INVALID_TID);
+	atomic_store(&parked, 1);
+}
+
+static void *source(void *arg)
+{
+	(void)arg;
+	while (!atomic_load(&parked))
+		sched_yield();
+	CHECK(so_signal_external(0) == 0);
+	CHECK(so_detach_source() == 0);
+	atomic_store(&detached, 1);
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t thread;
+
+	for (int i = 0; i != ROUNDS; ++i) {
+		atomic_store(&parked, 0);
+		atomic_store(&detached, 0);
+		CHECK(so_init(1, 1) == 0);
+		CHECK(so_attach_source() == 0);
+		CHECK(pthread_create(&thread, NULL, source, NULL) == 0);
+		CHECK(so_fork(root, 0) != INVALID_TID);
+		so_end();
+		CHECK(pthread_join(thread, NULL) == 0);
+	}
+
+	CHECK(woken == ROUNDS);
+	return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * Task lifecycle test: so_join and the order of the so_on_exit callbacks,
+ * so_cancel of a subtree of waiting tasks, the exit callbacks of a
+ * cancelled task calling so_signal, so_setprio switching only for a
+ * higher priority, the children of a joined task
+ * handed over to its parent, and the calls refused to a thread which is
+ * not the running task.
+ */
+
+#include <stdatomic.h>
+
+#include "test.h"
+#include "../so_scheduler.h"
+
+/* Exit callbacks called so far, one letter each */
+static char calls[16];
+static int ncalls;
+
+/* Steps of the tasks reached so far */
+static int child_done, waited, woke, cb_finished, raised;
+static tid_t grandchild;
+static atomic_int stop;
+
+static void record(void *arg)
+{
+	calls[ncalls++] = *(const char *)arg;
+}
+
+/* Parent of the task with sequence id seq in so_dump_state, -1 if it is gone */
+static int parent_of(unsigned int seq)
+{
+	unsigned int task, parent;
+	char line[256];
+	int found = -1;
+	FILE *dump;
+
+	CHECK((dump = tmpfile()) != NULL);
+	CHECK(so_dump_state(NULL, fileno(dump)) == 0);
+	rewind(dump);
+
+	while (fgets(line, sizeof(line), dump))
+		if (sscanf(line, "task %u %*s %*s prio %*d quantum %*d parent %u", &task,
+			   &parent) == 2 && task == seq)
+			found = parent;
+
+	fclose(dump);
+	return found;
+}
+
+static void child(unsigned int prio)
+{
+	(void)prio;
+	so_exec();
+	child_done = 1;
+}
+
+/* The callbacks run last registered first, before the joiner wakes up */
+static void join_root(unsigned int prio)
+{
+	tid_t tid = so_fork(child, prio - 1);
+
+	CHECK(tid != INVALID_TID);
+	CHECK(so_on_exit(tid, record, "a") == 0);
+	CHECK(so_on_exit(tid, record, "b") == 0);
+	CHECK(so_on_exit(tid, NULL, NULL) == -1);
+
+	CHECK(so_join(pthread_self()) == -1);
+	CHECK(so_join(tid) == 0);
+	CHECK(child_done && ncalls == 2 && !strncmp(calls, "ba", 2));
+}
+
+static void waiter(unsigned int prio)
+{
+	(void)prio;
+	so_wait(0);
+	waited = 1;
+}
+
+static void waiting_parent(unsigned int prio)
+{
+	grandchild = so_fork(waiter, prio + 1);
+	CHECK(grandchild != INVALID_TID);
+	waiter(prio);
+}
+
+/* Seq ids: 1 for the root, 2 for the parent, 3 for the grandchild */
+static void cancel_root(unsigned int prio)
+{
+	tid_t tid = so_fork(waiting_parent, prio + 1);
+
+	CHECK(tid != INVALID_TID && grandchild != INVALID_TID);
+	CHECK(parent_of(3) == 2);
+	CHECK(so_on_exit(tid, record, "p") == 0);
+	CHECK(so_on_exit(grandchild, record, "g") == 0);
+
+	/* Both unwind from so_wait without returning from it, the grandchild first */
+	CHECK(so_cancel(tid) == 0);
+	CHECK(so_join(tid) == 0);
+	CHECK(parent_of(3) == 1);
+
+	CHECK(so_join(grandchild) == 0);
+	CHECK(parent_of(3) == -1);
+	CHECK(!waited && ncalls == 2 && !strncmp(calls, "gp", 2));
+}
+
+static void waker(void *arg)
+{
+	(void)arg;
+	CHECK(so_signal(0) == 1);
+	cb_finished = 1;
+}
+
+static void sleeper(unsigned int prio)
+{
+	(void)prio;
+	CHECK(so_wait(0) == 0);
+	woke = 1;
+}
+
+/* The callback of the cancelled task is no cancellation point, it wakes the sleeper */
+static void cancel_cb_root(unsigned int prio)
+{
+	tid_t tid;
+
+	CHECK(so_fork(sleeper, prio + 1) != INVALID_TID);
+	CHECK((tid = so_fork(waiter, prio + 2)) != INVALID_TID);
+	CHECK(so_on_exit(tid, waker, NULL) == 0);
+	CHECK(so_cancel(tid) == 0);
+	CHECK(so_join(tid) == 0);
+	CHECK(cb_finished && woke);
+}
+
+static void raised_task(unsigned int prio)
+{
+	(void)prio;
+	raised = 1;
+}
+
+/* Lowering or matching the caller's priority keeps it on the processor */
+static void prio_root(unsigned int prio)
+{
+	tid_t tid;
+
+	CHECK((tid = so_fork(raised_task, prio - 1)) != INVALID_TID);
+	CHECK(so_setprio(tid, 0) == 0 && so_getprio(tid) == 0);
+	CHECK(so_setprio(tid, prio) == 0 && so_getprio(tid) == (int)prio);
+	CHECK(!raised);
+
+	CHECK(so_setprio(tid, prio + 1) == 0);
+	CHECK(raised);
+}
+
+static void spinner(unsigned int prio)
+{
+	(void)prio;
+	while (!atomic_load(&stop))
+		so_exec();
+}
+
+static void run(so_handler *func, unsigned int prio)
+{
+	ncalls = 0;
+	CHECK(so_init(1, 1) == 0);
+	CHECK(so_fork(func, prio) != INVALID_TID);
+	so_end();
+}
+
+int main(void)
+{
+	tid_t tid;
+
+	run(join_root, 2);
+	run(cancel_root, 0);
+	waited = 0;
+	run(cancel_cb_root, 0);
+	CHECK(!waited);
+	run(prio_root, 2);
+
+	/* The main thread is not a task, it would run alongside the spinner */
+	ncalls = 0;
+	CHECK(so_init(1, 1) == 0);
+	CHECK((tid = so_fork(spinner, 0)) != INVALID_TID);
+	CHECK(so_join(tid) == -1);
+	CHECK(so_on_exit(tid, record, "x") == -1);
+	CHECK(so_cancel(tid) == -1);
+	CHECK(so_setprio(tid, 1) == -1);
+	CHECK(so_getprio(tid) == -1);
+	atomic_store(&stop, 1);
+	so_end();
+	CHECK(ncalls == 0);
+
+	return 0;
+}
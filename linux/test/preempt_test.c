@@ -0,0 +1,101 @@
+/**
+ * Preemptive mode test: tasks spinning on SO_CHECKPOINT with a checkpoint
+ * interval too long to ever reach are switched by the CPU timers alone,
+ * and tasks preempted while writing to a shared stream do not deadlock on
+ * its lock, not even with SIGUSR2 dumps requested meanwhile. SIGALRM ends
+ * a hung run.
+ */
+
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../so_scheduler.h"
+
+/* CPU time quantum, in ns */
+#define QUANTUM_NS 200000
+
+/* Spinners and how often each one has to get the processor back */
+#define SPINNERS 4
+#define ROUNDS 20
+
+#define WRITERS 40
+#define LINES 2000
+
+/* Lines between two SIGUSR2 dumps */
+#define DUMP_EVERY 500
+
+static volatile int owner = -1;
+static int turns[SPINNERS];
+static FILE *sink, *dumps;
+
+/* Only a preemption lets another spinner take the processor */
+static void spinner(void *arg, unsigned int prio)
+{
+	int id = (int)(long)arg;
+
+	(void)prio;
+	while (turns[id] != ROUNDS) {
+		if (owner != id) {
+			owner = id;
+			++turns[id];
+		}
+		SO_CHECKPOINT();
+	}
+}
+
+static void spin_root(unsigned int prio)
+{
+	for (long i = 0; i != SPINNERS; ++i)
+		CHECK(so_fork_arg(spinner, (void *)i, prio - 1) != INVALID_TID);
+}
+
+static void writer(unsigned int prio)
+{
+	for (int i = 0; i != LINES; ++i) {
+		fprintf(sink, "%u %d\n", prio, i);
+		if (i % DUMP_EVERY == 0)
+			CHECK(raise(SIGUSR2) == 0);
+		SO_CHECKPOINT();
+	}
+}
+
+static void write_root(unsigned int prio)
+{
+	for (int i = 0; i != WRITERS; ++i)
+		CHECK(so_fork(writer, prio - 1) != INVALID_TID);
+}
+
+static void run(so_handler *func)
+{
+	CHECK(so_init_preemptive(QUANTUM_NS, 1) == 0);
+	CHECK(so_set_checkpoint_interval(LONG_MAX) == 0);
+	if (dumps)
+		CHECK(so_dump_on_signal(NULL, fileno(dumps)) == 0);
+	CHECK(so_fork(func, 1) != INVALID_TID);
+	so_end();
+}
+
+int main(void)
+{
+	char line[256];
+
+	alarm(20);
+
+	run(spin_root);
+	for (int i = 0; i != SPINNERS; ++i)
+		CHECK(turns[i] == ROUNDS);
+
+	CHECK((sink = fopen("/dev/null", "w")) != NULL);
+	CHECK((dumps = tmpfile()) != NULL);
+	run(write_root);
+	fclose(sink);
+
+	/* The requests are served by the writers, running or exiting */
+	rewind(dumps);
+	CHECK(fgets(line, sizeof(line), dumps) && !strncmp(line, "scheduler ", 10));
+	fclose(dumps);
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+/**
+ * Stand-in for the systemtap <sys/sdt.h>, so the probe sites of probes.h
+ * are compiled without systemtap-sdt-dev. The arguments are evaluated and
+ * dropped, a real probe only reads them.
+ */
+
+#ifndef SYS_SDT_H_
+#define SYS_SDT_H_
+
+#define DTRACE_PROBE5(provider, name, a1, a2, a3, a4, a5)		\
+	do {								\
+		(void)(a1); (void)(a2); (void)(a3);			\
+		(void)(a4); (void)(a5);					\
+	} while (0)
+
+#define DTRACE_PROBE6(provider, name, a1, a2, a3, a4, a5, a6)		\
+	do {								\
+		(void)(a1); (void)(a2); (void)(a3);			\
+		(void)(a4); (void)(a5); (void)(a6);			\
+	} while (0)
+
+#endif /* SYS_SDT_H_ */
@@ -0,0 +1,86 @@
+/**
+ * Per-task statistics test: the main thread, outside the scheduler, reads
+ * the per-task counters while the tasks fork and grow the task table,
+ * while every task waits and the scheduler sleeps idle, and once the last
+ * task is gone but so_end was not called yet. SIGALRM ends a hung run.
+ */
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../so_scheduler.h"
+
+#define WORKERS 200
+#define EXECS 50
+#define POLLS 1000
+
+static so_task_stats_t tasks[WORKERS + 1];
+static atomic_int finished, parked;
+
+static void worker(unsigned int prio)
+{
+	(void)prio;
+	for (int i = 0; i != EXECS; ++i)
+		so_exec();
+	atomic_fetch_add(&finished, 1);
+}
+
+static void fork_root(unsigned int prio)
+{
+	for (int i = 0; i != WORKERS; ++i)
+		CHECK(so_fork(worker, prio) != INVALID_TID);
+}
+
+static void sleeper(unsigned int prio)
+{
+	(void)prio;
+	atomic_store(&parked, 1);
+	CHECK(so_wait(0) == 0);
+}
+
+/* Every copied entry belongs to a task forked so far */
+static int poll_stats(void)
+{
+	int cnt = so_get_stats(NULL, NULL, tasks, WORKERS + 1);
+
+	CHECK(cnt >= 1 && cnt <= WORKERS + 1);
+	for (int i = 0; i != cnt; ++i)
+		CHECK(tasks[i].seq >= 1 && tasks[i].seq <= WORKERS + 1);
+
+	return cnt;
+}
+
+int main(void)
+{
+	alarm(20);
+
+	CHECK(so_init(1, 1) == 0);
+	CHECK(so_fork(fork_root, 0) != INVALID_TID);
+	for (int i = 0; i != POLLS; ++i)
+		poll_stats();
+
+	/* No scheduling point is left, the caller copies the counters itself */
+	while (atomic_load(&finished) != WORKERS)
+		sched_yield();
+	usleep(10000);
+	CHECK(poll_stats() == WORKERS + 1);
+	for (int i = 0; i != WORKERS + 1; ++i)
+		CHECK(tasks[i].seq == 1 || tasks[i].ticks_run >= EXECS);
+	so_end();
+
+	/* The request wakes the idle scheduler up */
+	CHECK(so_init(1, 1) == 0);
+	CHECK(so_attach_source() == 0);
+	CHECK(so_fork(sleeper, 0) != INVALID_TID);
+	while (!atomic_load(&parked))
+		sched_yield();
+	usleep(10000);
+	CHECK(poll_stats() == 1 && tasks[0].seq == 1);
+	CHECK(so_signal_external(0) == 0);
+	CHECK(so_detach_source() == 0);
+	so_end();
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * Randomized task table test: inserts, removals (backward shift deletion)
+ * and lookups checked against a plain array indexed by key, with keys
+ * spaced like pthread ids so probe chains form and wrap around.
+ */
+
+#include "test.h"
+#include "../task_table.h"
+
+#define KEYS 4096
+#define OPS 1000000
+
+/* Keys are (k + 1) * KEY_STRIDE, aligned like thread descriptors */
+#define KEY_STRIDE 0x1000
+
+static int values[KEYS];
+static void *ref[KEYS];
+
+static void free_value(void *a)
+{
+	(void)a;
+}
+
+/* Every live entry is reachable by key and walking the table */
+static void check_all(task_table_t *table)
+{
+	int live = 0;
+	void *val;
+
+	for (int k = 0; k != KEYS; ++k) {
+		CHECK(table_find(table, (tid_t)(k + 1) * KEY_STRIDE) == ref[k]);
+		live += ref[k] != NULL;
+	}
+
+	CHECK(table_size(table) == live);
+	for (int i = 0; i != live; ++i) {
+		val = table_get(table, i);
+		CHECK(val && ref[(int *)val - values] == val);
+	}
+}
+
+int main(void)
+{
+	task_table_t *table = table_init(free_value);
+	unsigned int seed = 1;
+	int k;
+
+	for (int i = 0; i != OPS; ++i) {
+		k = rand_r(&seed) % KEYS;
+
+		switch (rand_r(&seed) % 3) {
+		case 0:
+			table_insert(table, (tid_t)(k + 1) * KEY_STRIDE, &values[k]);
+			ref[k] = &values[k];
+			break;
+		case 1:
+			CHECK(table_remove(table, (tid_t)(k + 1) * KEY_STRIDE) == ref[k]);
+			ref[k] = NULL;
+			break;
+		default:
+			CHECK(table_find(table, (tid_t)(k + 1) * KEY_STRIDE) == ref[k]);
+		}
+
+		if (!(i % 100000))
+			check_all(table);
+	}
+
+	/* Empty it, then every key is gone */
+	for (k = 0; k != KEYS; ++k) {
+		CHECK(table_remove(table, (tid_t)(k + 1) * KEY_STRIDE) == ref[k]);
+		ref[k] = NULL;
+	}
+	check_all(table);
+	CHECK(table_find(table, INVALID_TID) == NULL);
+
+	table_free(table);
+	return 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * Check macro shared by the unit tests, a failed check reports where it
+ * failed and exits with 1.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include "../utils.h"
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "(%s, %d): check failed: %s\n",	\
+				__FILE__, __LINE__, #cond);		\
+			exit(1);					\
+		}							\
+	} while (0)
+
+#endif /* TEST_H_ */
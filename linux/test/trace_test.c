@@ -0,0 +1,85 @@
+/**
+ * Trace test: the trace written by so_destroy through so_trace_on_end
+ * holds every event of the run, with timestamps converted to increasing
+ * CLOCK_MONOTONIC times inside the run, and the names of the tasks
+ * reaped by so_join before the end.
+ */
+
+#include <time.h>
+
+#include "test.h"
+#include "../so_scheduler.h"
+#include "../trace.h"
+
+#define CHILDREN 20
+
+static void child(unsigned int prio)
+{
+	(void)prio;
+	so_exec();
+}
+
+static void root(unsigned int prio)
+{
+	char name[SO_TASK_NAME_LEN];
+	tid_t tid;
+
+	for (int i = 0; i != CHILDREN; ++i) {
+		snprintf(name, sizeof(name), "child-%d", i);
+		CHECK((tid = so_fork_named(child, prio, name)) != INVALID_TID);
+		CHECK(so_join(tid) == 0);
+	}
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(void)
+{
+	trace_name_t names[CHILDREN + 1];
+	uint64_t start, end, prev;
+	trace_hdr_t hdr;
+	trace_rec_t rec;
+	char name[SO_TASK_NAME_LEN];
+	FILE *out;
+
+	CHECK((out = tmpfile()) != NULL);
+
+	start = now_ns();
+	CHECK(so_init(1, 1) == 0);
+	CHECK(so_trace_start(NULL, 4096) == 0);
+	CHECK(so_trace_on_end(NULL, -1) == -1);
+	CHECK(so_trace_on_end(NULL, fileno(out)) == 0);
+	CHECK(so_fork(root, 0) != INVALID_TID);
+	so_end();
+	end = now_ns();
+
+	rewind(out);
+	CHECK(fread(&hdr, sizeof(hdr), 1, out) == 1);
+	CHECK(!memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)));
+	CHECK(hdr.rec_size == sizeof(rec) && hdr.names == CHILDREN + 1);
+
+	/* Every fork and exit is in, the root exits last */
+	prev = start;
+	for (uint64_t i = 0; i != hdr.count; ++i) {
+		CHECK(fread(&rec, sizeof(rec), 1, out) == 1);
+		CHECK(rec.ts >= prev && rec.ts <= end);
+		prev = rec.ts;
+	}
+	CHECK(rec.type == TRACE_EXIT && rec.task == 1);
+
+	/* Named when forked, in fork order */
+	CHECK(fread(names, sizeof(names[0]), CHILDREN + 1, out) == CHILDREN + 1);
+	for (int i = 0; i != CHILDREN; ++i) {
+		snprintf(name, sizeof(name), "child-%d", i);
+		CHECK(names[i + 1].task == (uint32_t)i + 2 && !strcmp(names[i + 1].name, name));
+	}
+
+	fclose(out);
+	return 0;
+}
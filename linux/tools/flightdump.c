@@ -0,0 +1,93 @@
+/**
+ * Prints the content of a flight recorder file written through
+ * so_flight_record: the last scheduling events, oldest first, then the
+ * last known state of every task. Works on the file of a live process
+ * as well as on the one of a crashed process.
+ *
+ * Usage: flightdump flight.bin
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../flight.h"
+
+static const char * const events[TRACE_TYPES] = {
+	"fork", "dispatch", "preempt", "wait", "signal", "exit", "idle", "join"
+};
+
+static const char * const states[] = {
+	"READY", "RUNNING", "WAITING", "TERMINATED"
+};
+
+int main(int argc, char **argv)
+{
+	flight_hdr_t *hdr;
+	trace_rec_t *recs, *rec;
+	task_slot_t *slots, *slot;
+	struct stat st;
+	uint64_t first, last, ns;
+	int fd;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s flight.bin\n", argv[0]);
+		return 1;
+	}
+
+	DIE((fd = open(argv[1], O_RDONLY)) < 0, "open failed!");
+	DIE(fstat(fd, &st), "fstat failed!");
+	if ((size_t)st.st_size < sizeof(flight_hdr_t)) {
+		fprintf(stderr, "%s: not a flight recorder file\n", argv[1]);
+		return 1;
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	DIE(hdr == MAP_FAILED, "mmap failed!");
+	close(fd);
+
+	if (memcmp(hdr->magic, FLIGHT_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->rec_size != sizeof(trace_rec_t) || hdr->slot_size != sizeof(task_slot_t) ||
+	    sizeof(flight_hdr_t) + hdr->records * sizeof(trace_rec_t) +
+	    hdr->slots * sizeof(task_slot_t) > (uint64_t)st.st_size) {
+		fprintf(stderr, "%s: not a flight recorder file\n", argv[1]);
+		return 1;
+	}
+
+	recs = (trace_rec_t *)(hdr + 1);
+	slots = (task_slot_t *)(recs + hdr->records);
+
+	/* Snapshot the counter, a live process keeps writing */
+	last = hdr->head;
+	first = last > hdr->records ? last - hdr->records : 0;
+
+	printf("events %" PRIu64 "-%" PRIu64 " of %" PRIu64 "\n", first, last, last);
+	for (uint64_t i = first; i != last; ++i) {
+		rec = &recs[i & (hdr->records - 1)];
+		ns = trace_ns(&hdr->clock[0], &hdr->clock[1], rec->ts);
+		printf("%" PRIu64 ".%09" PRIu64 " task %" PRIu32 " prio %u %s %" PRIu32 "\n",
+		       ns / 1000000000, ns % 1000000000, rec->task, rec->prio,
+		       rec->type < TRACE_TYPES ? events[rec->type] : "?", rec->arg);
+	}
+
+	printf("\ntasks\n");
+	for (uint64_t i = 0; i != hdr->slots; ++i) {
+		slot = &slots[i];
+		if (!slot->seq)
+			continue;
+
+		printf("task %" PRIu32 " %.*s parent %" PRIu32 " prio %u %s", slot->seq,
+		       (int)sizeof(slot->name), slot->name, slot->parent, slot->prio,
+		       slot->state < 4 ? states[slot->state] : "?");
+		if (slot->io != FLIGHT_NO_IO)
+			printf(" io %u", slot->io);
+		ns = trace_ns(&hdr->clock[0], &hdr->clock[1], slot->ts);
+		printf(" quantum %" PRId32 " at %" PRIu64 ".%09" PRIu64 "\n", slot->time_quantum,
+		       ns / 1000000000, ns % 1000000000);
+	}
+
+	munmap(hdr, st.st_size);
+	return 0;
+}
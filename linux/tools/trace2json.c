@@ -0,0 +1,135 @@
+/**
+ * Converts a trace written by so_trace_write to the Chrome trace event
+ * JSON format, which chrome://tracing and ui.perfetto.dev open. Every
+ * task is a thread lane with a slice for each time it held the processor
+ * and an instant for each of its events.
+ *
+ * Usage: trace2json trace.bin > trace.json
+ */
+
+#include <inttypes.h>
+
+#include "../trace.h"
+
+static const char * const events[TRACE_TYPES] = {
+	"fork", "dispatch", "preempt", "wait", "signal", "exit", "idle", "join"
+};
+
+static int first = 1;
+
+/* Separator before the next element of the event array */
+static void next(void)
+{
+	printf("%s\n", first ? "" : ",");
+	first = 0;
+}
+
+static void event(const char *ph, const char *name, uint32_t task, double us)
+{
+	next();
+	printf("{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%.3f%s}",
+	       ph, name, task, us, ph[0] == 'i' ? ",\"s\":\"t\"" : "");
+}
+
+/* Thread name metadata of a task lane, name is escaped for JSON */
+static void lane(uint32_t task, const char *name, size_t len)
+{
+	next();
+	printf("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%" PRIu32
+	       ",\"args\":{\"name\":\"", task);
+	for (size_t i = 0; i != len && name[i]; ++i) {
+		if (name[i] == '"' || name[i] == '\\')
+			printf("\\%c", name[i]);
+		else if ((unsigned char)name[i] < 0x20)
+			printf("\\u%04x", name[i]);
+		else
+			putchar(name[i]);
+	}
+	printf("\"}}");
+}
+
+/* Checks if the names table has an entry for task */
+static int named(trace_name_t *names, uint32_t n, uint32_t task)
+{
+	for (uint32_t i = 0; i != n; ++i)
+		if (names[i].task == task)
+			return 1;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	trace_name_t *names;
+	trace_hdr_t hdr;
+	trace_rec_t rec;
+	char label[32];
+	uint64_t start = 0, last = 0;
+	uint32_t running = 0;
+	FILE *in;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	DIE(!(in = fopen(argv[1], "rb")), "fopen failed!");
+	DIE(fread(&hdr, sizeof(hdr), 1, in) != 1, "fread failed!");
+	if (memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) || hdr.rec_size != sizeof(rec)) {
+		fprintf(stderr, "%s: not a scheduler trace\n", argv[1]);
+		return 1;
+	}
+
+	/* The names follow the records */
+	DIE(!(names = calloc(hdr.names ? hdr.names : 1, sizeof(trace_name_t))), "calloc failed!");
+	DIE(fseek(in, hdr.count * sizeof(rec), SEEK_CUR), "fseek failed!");
+	DIE(fread(names, sizeof(trace_name_t), hdr.names, in) != hdr.names, "fread failed!");
+	DIE(fseek(in, sizeof(hdr), SEEK_SET), "fseek failed!");
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (uint32_t i = 0; i != hdr.names; ++i)
+		lane(names[i].task, names[i].name, sizeof(names[i].name));
+
+	for (uint64_t i = 0; i != hdr.count; ++i) {
+		DIE(fread(&rec, sizeof(rec), 1, in) != 1, "fread failed!");
+		if (!i)
+			start = rec.ts;
+		last = rec.ts;
+
+		if (rec.type >= TRACE_TYPES)
+			continue;
+
+		/* A dispatch ends the slice of the previous task */
+		if (rec.type == TRACE_DISPATCH && running && running != rec.task)
+			event("E", "run", running, (rec.ts - start) / 1e3);
+		if (rec.type == TRACE_DISPATCH && running != rec.task)
+			event("B", "run", rec.task, (rec.ts - start) / 1e3);
+		if (rec.type == TRACE_DISPATCH) {
+			running = rec.task;
+			continue;
+		}
+
+		/* A write from outside the tasks during the run leaves the names out */
+		if (rec.type == TRACE_FORK && !named(names, hdr.names, rec.task)) {
+			snprintf(label, sizeof(label), "task %" PRIu32 " prio %u", rec.task, rec.prio);
+			lane(rec.task, label, sizeof(label));
+		}
+
+		event("i", events[rec.type], rec.task, (rec.ts - start) / 1e3);
+
+		/* The task leaves the processor */
+		if ((rec.type == TRACE_PREEMPT || rec.type == TRACE_WAIT || rec.type == TRACE_EXIT) &&
+		    rec.task == running) {
+			event("E", "run", running, (rec.ts - start) / 1e3);
+			running = 0;
+		}
+	}
+
+	if (running)
+		event("E", "run", running, (last - start) / 1e3);
+	printf("\n]}\n");
+
+	free(names);
+	fclose(in);
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "trace.h"
+
+/* Records converted per write by trace_write */
+#define WRITE_BATCH 256
+
+/*
+ * Timestamp counter: the TSC on x86, constant rate on any CPU of the last
+ * decade, a few ns against ~40 for clock_gettime. CLOCK_MONOTONIC elsewhere
+ */
+uint64_t trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void trace_clock(trace_clock_t *clock)
+{
+	struct timespec ts;
+
+	clock->ticks = trace_ticks();
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	clock->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* CLOCK_MONOTONIC time of ticks, at the rate measured between from and to */
+uint64_t trace_ns(const trace_clock_t *from, const trace_clock_t *to, uint64_t ticks)
+{
+	double rate = 1;
+
+	if (to->ticks != from->ticks)
+		rate = (double)(to->ns - from->ns) / (to->ticks - from->ticks);
+
+	return from->ns + (int64_t)((double)(int64_t)(ticks - from->ticks) * rate);
+}
+
+trace_ring_t *trace_init(unsigned int capacity)
+{
+	trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+	uint64_t size = 1;
+
+	DIE(!ring, "trace calloc failed!");
+
+	/* Round up, so the position in the ring is a mask away from head */
+	while (size < capacity)
+		size <<= 1;
+
+	ring->mask = size - 1;
+	ring->head = &ring->count;
+	DIE(!(ring->recs = calloc(size, sizeof(trace_rec_t))), "recs calloc failed!");
+	trace_clock(&ring->start);
+
+	return ring;
+}
+
+/* Ring over caller-owned memory, capacity must be a power of two */
+trace_ring_t *trace_map(trace_rec_t *recs, unsigned int capacity, uint64_t *head)
+{
+	trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+
+	DIE(!ring, "trace calloc failed!");
+	DIE(!capacity || (capacity & (capacity - 1)), "Invalid trace capacity!");
+
+	ring->recs = recs;
+	ring->mask = capacity - 1;
+	ring->head = head;
+	ring->mapped = 1;
+	trace_clock(&ring->start);
+
+	return ring;
+}
+
+/* Single writer, the running task */
+void trace_add(trace_ring_t *ring, int type, unsigned int task, int prio, int arg)
+{
+	trace_rec_t *rec = &ring->recs[(*ring->head)++ & ring->mask];
+
+	rec->ts = trace_ticks();
+	rec->task = task;
+	rec->type = type;
+	rec->prio = prio;
+	rec->arg = arg;
+}
+
+/* Keeps the name of a task for every later trace_write, single writer like trace_add */
+void trace_name(trace_ring_t *ring, unsigned int task, const char *name)
+{
+	trace_name_t *names;
+
+	if (ring->nnames == ring->names_cap) {
+		ring->names_cap = ring->names_cap ? 2 * ring->names_cap : 64;
+		names = realloc(ring->names, ring->names_cap * sizeof(trace_name_t));
+		DIE(!names, "names realloc failed!");
+		ring->names = names;
+	}
+
+	names = &ring->names[ring->nnames++];
+	names->task = task;
+	snprintf(names->name, sizeof(names->name), "%s", name);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (const char *)buf + ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* Writes count records from index first of the ring, timestamps in ns */
+static int write_recs(trace_ring_t *ring, int fd, uint64_t first, uint64_t count,
+		      const trace_clock_t *now)
+{
+	trace_rec_t batch[WRITE_BATCH];
+	uint64_t len;
+
+	while (count) {
+		len = count < WRITE_BATCH ? count : WRITE_BATCH;
+		for (uint64_t i = 0; i != len; ++i) {
+			batch[i] = ring->recs[(first + i) & ring->mask];
+			batch[i].ts = trace_ns(&ring->start, now, batch[i].ts);
+		}
+		if (write_all(fd, batch, len * sizeof(trace_rec_t)))
+			return -1;
+		first += len;
+		count -= len;
+	}
+
+	return 0;
+}
+
+/* Writes the header, the records still in the ring, oldest first, and the first names */
+int trace_write(trace_ring_t *ring, int fd, uint32_t names)
+{
+	trace_hdr_t hdr = { .rec_size = sizeof(trace_rec_t) };
+	uint64_t size = ring->mask + 1;
+	uint64_t head = *ring->head;
+	uint64_t first = head > size ? head - size : 0;
+	trace_clock_t now;
+
+	/* The rate is measured over the whole recording */
+	trace_clock(&now);
+
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.count = head - first;
+	hdr.names = names;
+	if (write_all(fd, &hdr, sizeof(hdr)) || write_recs(ring, fd, first, hdr.count, &now))
+		return -1;
+
+	return write_all(fd, ring->names, names * sizeof(trace_name_t));
+}
+
+void trace_free(trace_ring_t *ring)
+{
+	if (!ring)
+		return;
+
+	if (!ring->mapped)
+		free(ring->recs);
+	free(ring->names);
+	free(ring);
+}
@@ -0,0 +1,120 @@
+/**
+ * Scheduler trace ring buffer.
+ * Every scheduling event is a fixed-size binary record written into a
+ * power of two ring, so recording is a timestamp counter read and a 24
+ * byte store, with no allocation, locking or system clock read. The
+ * counter is converted to CLOCK_MONOTONIC ns when the trace is written.
+ * Once the ring is full, the oldest records are overwritten. This header
+ * also describes the format of the trace files, see tools/trace2json.c.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/* Magic number at the start of a trace file */
+#define TRACE_MAGIC "SOTRACE1"
+
+/* Event types */
+enum {
+	TRACE_FORK, /* Task created, arg is the sequence id of its parent */
+	TRACE_DISPATCH, /* Task planned on the processor */
+	TRACE_PREEMPT, /* Task put back in the ready queue, arg is a TRACE_PREEMPT_* reason */
+	TRACE_WAIT, /* Task started waiting, arg is the io */
+	TRACE_SIGNAL, /* Task signaled an io, arg is the io */
+	TRACE_EXIT, /* Task terminated */
+	TRACE_IDLE, /* Scheduler went idle with every task waiting */
+	TRACE_JOIN, /* Task parked in so_join, arg is the sequence id of the target */
+	TRACE_TYPES
+};
+
+/* Preemption reasons */
+enum {
+	TRACE_PREEMPT_PRIO, /* A task with a higher priority became ready */
+	TRACE_PREEMPT_QUANTUM /* The time quantum expired */
+};
+
+typedef struct trace_rec_t trace_rec_t;
+struct trace_rec_t {
+	/* Timestamp counter in the ring, CLOCK_MONOTONIC time in ns in a trace file */
+	uint64_t ts;
+	/* Sequence id of the task, 0 for events from outside the tasks */
+	uint32_t task;
+	/* Event specific argument, as wide as task for the sequence ids */
+	uint32_t arg;
+	/* Event type */
+	uint8_t type;
+	/* Priority of the task */
+	uint8_t prio;
+};
+
+/* Length of a task name, NUL included */
+#define TRACE_NAME_LEN 16
+
+/*
+ * Header of a trace file, followed by count records, oldest first, then
+ * by names task names
+ */
+typedef struct trace_hdr_t trace_hdr_t;
+struct trace_hdr_t {
+	char magic[8];
+	uint32_t rec_size;
+	uint32_t names;
+	uint64_t count;
+};
+
+typedef struct trace_name_t trace_name_t;
+struct trace_name_t {
+	/* Sequence id of the task */
+	uint32_t task;
+	char name[TRACE_NAME_LEN];
+};
+
+/* Timestamp counter value and the CLOCK_MONOTONIC time read along */
+typedef struct trace_clock_t trace_clock_t;
+struct trace_clock_t {
+	uint64_t ticks;
+	uint64_t ns;
+};
+
+typedef struct trace_ring_t trace_ring_t;
+struct trace_ring_t {
+	/* Records, indexed by the write count masked */
+	trace_rec_t *recs;
+	/* Capacity - 1, the capacity is a power of two */
+	uint64_t mask;
+	/* Number of records written since the start, count or a mapped counter */
+	uint64_t *head;
+	uint64_t count;
+	/* The records are not owned by the ring */
+	int mapped;
+	/* Clock when the ring was created, the timestamps are converted from it */
+	trace_clock_t start;
+	/* Names of every task named so far, the reaped ones included */
+	trace_name_t *names;
+	uint32_t nnames;
+	uint32_t names_cap;
+};
+
+uint64_t trace_ticks(void);
+
+void trace_clock(trace_clock_t *clock);
+
+uint64_t trace_ns(const trace_clock_t *from, const trace_clock_t *to, uint64_t ticks);
+
+trace_ring_t *trace_init(unsigned int capacity);
+
+trace_ring_t *trace_map(trace_rec_t *recs, unsigned int capacity, uint64_t *head);
+
+void trace_add(trace_ring_t *ring, int type, unsigned int task, int prio, int arg);
+
+void trace_name(trace_ring_t *ring, unsigned int task, const char *name);
+
+int trace_write(trace_ring_t *ring, int fd, uint32_t names);
+
+void trace_free(trace_ring_t *ring);
+
+#endif /* TRACE_H_ */